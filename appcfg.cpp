@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+
+#ifdef _MSC_VER
+#define strnicmp	_strnicmp
+#else
+#define strnicmp	strncasecmp
+#endif
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <limits.h>	// for PATH_MAX
+#endif
+
+#include <ini.h>
+
+#include <stdtype.h>
+#include "utils.hpp"
+#include "config.hpp"
+#include "appcfg.hpp"
+
+#ifndef SHARE_PREFIX
+#define SHARE_PREFIX	"/usr"
+#endif
+
+
+static char* GetAppFilePath(void);
+static int IniValHandler(void* user, const char* section, const char* name, const char* value);
+
+
+static char* GetAppFilePath(void)
+{
+	char* appPath;
+	int retVal;
+	
+#ifdef _WIN32
+	std::vector<wchar_t> appPathW;
+	
+	appPathW.resize(MAX_PATH);
+	retVal = GetModuleFileNameW(NULL, &appPathW[0], appPathW.size());
+	if (! retVal)
+		appPathW[0] = L'\0';
+	
+	retVal = WideCharToMultiByte(CP_UTF8, 0, &appPathW[0], -1, NULL, 0, NULL, NULL);
+	if (retVal < 0)
+		retVal = 1;
+	appPath = (char*)malloc(retVal);
+	retVal = WideCharToMultiByte(CP_UTF8, 0, &appPathW[0], -1, appPath, retVal, NULL, NULL);
+	if (retVal < 0)
+		appPath[0] = '\0';
+	appPathW.clear();
+#else
+	appPath = (char*)malloc(PATH_MAX * sizeof(char));
+	retVal = readlink("/proc/self/exe", appPath, PATH_MAX - 1);
+	if (retVal == -1)
+		retVal = 0;
+	appPath[retVal] = '\0';	// readlink() doesn't terminate the string
+#endif
+	
+	return appPath;
+}
+
+void InitAppSearchPaths(const char* argv_0, std::vector<std::string>& searchPaths)
+{
+	searchPaths.clear();
+	
+#ifndef _WIN32
+	// 1. [Unix only] global share directory
+	searchPaths.push_back(SHARE_PREFIX "/share/vgmplay/");
+#endif
+	
+	// 2. actual application path (potentially resolved symlink)
+	char* appPath = GetAppFilePath();
+	const char* appTitle = GetFileTitle(appPath);
+	if (appTitle != appPath)
+		searchPaths.push_back(std::string(appPath, appTitle - appPath));
+	free(appPath);
+	
+	// 3. called path
+	appTitle = GetFileTitle(argv_0);
+	if (appTitle != argv_0)
+	{
+		std::string callPath(argv_0, appTitle - argv_0);
+		if (searchPaths.empty() || callPath != searchPaths[searchPaths.size() - 1])
+			searchPaths.push_back(callPath);
+	}
+	
+	// 4. home/config directory
+	std::string cfgDir;
+#ifdef _WIN32
+	cfgDir = getenv("USERPROFILE");
+	cfgDir += "/.vgmplay/";
+#else
+	char* xdgPath = getenv("XDG_CONFIG_HOME");
+	if (xdgPath != NULL && xdgPath[0] != '\0')
+	{
+		cfgDir = xdgPath;
+	}
+	else
+	{
+		cfgDir = getenv("HOME");
+		cfgDir += "/.config";
+	}
+	cfgDir += "/vgmplay/";
+#endif
+	searchPaths.push_back(cfgDir);
+	
+	// 5. working directory
+	searchPaths.push_back("./");
+	
+	return;
+}
+
+static int IniValHandler(void* user, const char* section, const char* name, const char* value)
+{
+	Configuration* cfg = (Configuration*)user;
+	
+	bool ordered = false;
+	if (! strnicmp(name, "Mute", 4))
+		ordered = true;
+	else if (! strnicmp(name, "Pan", 3))
+		ordered = true;
+	
+	cfg->AddEntry(section, name, value, ordered);
+	
+	return 1;
+}
+
+UINT8 LoadConfig(const std::string& iniPath, Configuration& cfg)
+{
+	int retVal;
+	
+	retVal = ini_parse(iniPath.c_str(), IniValHandler, &cfg);
+	if (retVal == -2)
+		return 0xF8;	// malloc error
+	else if (retVal == -1)
+		return 0xF0;	// file not found
+	else if (retVal < 0)
+		return 0xFF;	// unknown error
+	else if (retVal > 0)
+		return 0x01;	// parse error
+	else
+		return 0x00;
+}
+
+UINT8 AddConfigOption(Configuration& cfg, const char* optStr)
+{
+	std::string optstr = optStr;
+	char* sect = &optstr[0];
+	char* key = strchr(sect, '.');
+	if (key == NULL)
+		return 0xFF;
+	*key = '\0';	key ++;
+	char* val = strchr(key, '=');
+	if (val == NULL)
+		return 0xFF;
+	*val = '\0';	val ++;
+	// reuse INI handler, so that the MuteMask values are put into the correct section
+	IniValHandler(&cfg, sect, key, val);
+	
+	return 0x00;
+}
@@ -0,0 +1,17 @@
+#ifndef __APPCFG_HPP__
+#define __APPCFG_HPP__
+
+#include <vector>
+#include <string>
+#include <stdtype.h>
+#include "config.hpp"
+
+// configuration loading, shared by the player and vgmplay-bench
+
+// directories to search for VGMPlay.ini and files that songs need (share dir, application path, config dir, working dir)
+void InitAppSearchPaths(const char* argv_0, std::vector<std::string>& searchPaths);
+UINT8 LoadConfig(const std::string& iniPath, Configuration& cfg);
+// command line option, format: section.key=Data
+UINT8 AddConfigOption(Configuration& cfg, const char* optStr);
+
+#endif	// __APPCFG_HPP__
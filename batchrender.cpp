@@ -0,0 +1,562 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <ctype.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+
+#ifdef _WIN32
+#include <direct.h>		// for _mkdir()
+#else
+#include <sys/stat.h>	// for mkdir()
+#endif
+
+#include <stdtype.h>
+#include <utils/DataLoader.h>
+#include <player/playerbase.hpp>
+#include <player/s98player.hpp>
+#include <player/droplayer.hpp>
+#include <player/vgmplayer.hpp>
+#include <player/playera.hpp>
+#include <utils/OSMutex.h>
+#include <utils/OSThread.h>
+#include <emu/SoundEmu.h>	// for SndEmu_GetDevName()
+
+#include "utils.hpp"
+#include "config.hpp"
+#include "m3uargparse.hpp"
+#include "playcfg.hpp"
+#include "mediainfo.hpp"
+#include "loaders.hpp"
+#include "wavwriter.hpp"
+#include "batchrender.hpp"
+
+
+struct RenderWorker
+{
+	MediaInfo* mInfo;
+	std::vector<UINT8> smplBuf;
+	OS_THREAD* thread;
+};
+
+
+//UINT8 BatchRenderMain(const std::string& outDir);
+static void RenderWorkerThread(void* args);
+static void InitRenderPlayer(MediaInfo& mInfo, std::vector<UINT8>& smplBuf);
+static void DeinitRenderPlayer(MediaInfo& mInfo);
+static UINT8 RenderSong(MediaInfo& mInfo, size_t songIdx, const std::string& outFileName, std::vector<UINT8>& smplBuf);
+static UINT8 RenderStems(MediaInfo& mInfo, size_t songIdx, const std::string& outFileName, std::vector<UINT8>& smplBuf);
+static UINT8 RenderToFile(MediaInfo& mInfo, size_t songIdx, const std::string& outFileName, std::vector<UINT8>& smplBuf);
+static UINT8 RenderToWriter(MediaInfo& mInfo, size_t songIdx, WavWriter& wavOut, std::vector<UINT8>& smplBuf);
+static void MakeOutputFileNames(const std::string& outDir);
+static std::string GetOutputFileTitle(const std::string& songFileName);
+static std::string LowerCaseStr(std::string str);
+static std::string GetStemFileName(const std::string& outFileName, size_t devIdx, const PLR_DEV_INFO& pdi);
+static void ConvertS32ToFloat(void* buffer, UINT32 bytes);
+static UINT8 CreateOutputDir(const std::string& dirPath);
+static UINT8 RenderPlayCallback(PlayerBase* player, void* userParam, UINT8 evtType, void* evtParam);
+
+
+#define RENDER_CHANNELS	2
+
+extern Configuration playerCfg;
+extern std::vector<SongFileList> songList;
+
+// job queue shared by all workers
+static std::vector<std::string> outFileNames;	// output file of each song
+static OS_MUTEX* jobMutex = NULL;
+static size_t nextSong;
+static size_t errCnt;
+static WavWriter* streamOut = NULL;	// stream mode: all songs go into this writer
+
+static inline UINT32 MSec2Samples(UINT32 val, const PlayerA& player)
+{
+	return (UINT32)(((UINT64)val * player.GetSampleRate() + 500) / 1000);
+}
+
+UINT8 BatchRenderMain(const std::string& outDir)
+{
+	std::vector<RenderWorker> workers;
+	size_t curWrk;
+	size_t thrCnt;
+	UINT8 retVal;
+	
+	retVal = CreateOutputDir(outDir);
+	if (retVal)
+	{
+		u8printf("Unable to create output directory %s!\n", outDir.c_str());
+		return 1;
+	}
+	
+	// Each worker gets its own player, so that songs can be rendered in parallel.
+	// Songs don't share any state, so the output is the same as when rendering one song after another.
+	workers.resize(1);
+	workers[0].mInfo = new MediaInfo;	// allocated on the heap, because the chip options are large
+	ParseConfiguration(workers[0].mInfo->_genOpts, 0x100, workers[0].mInfo->_chipOpts, playerCfg);
+	{
+		GeneralOptions& genOpts = workers[0].mInfo->_genOpts;
+		if (! genOpts.maxLoops)
+			genOpts.maxLoops = 1;	// infinite looping would never finish the file
+		thrCnt = genOpts.renderThreads ? genOpts.renderThreads : GetCPUCoreCount();
+		if (thrCnt > songList.size())
+			thrCnt = songList.size();
+		if (thrCnt < 1)
+			thrCnt = 1;
+	}
+	workers.resize(thrCnt);
+	for (curWrk = 1; curWrk < workers.size(); curWrk ++)
+	{
+		// reuse the parsed configuration instead of parsing it again for every worker
+		MediaInfo* mInfo = new MediaInfo;
+		mInfo->_genOpts = workers[0].mInfo->_genOpts;
+		for (size_t curChp = 0; curChp < 0x100; curChp ++)
+			mInfo->_chipOpts[curChp] = workers[0].mInfo->_chipOpts[curChp];
+		workers[curWrk].mInfo = mInfo;
+	}
+	
+	Loaders_Init();
+	Loaders_SetAuxCacheSize((UINT64)workers[0].mInfo->_genOpts.auxCacheSize << 20);
+	for (curWrk = 0; curWrk < workers.size(); curWrk ++)
+	{
+		RenderWorker& rw = workers[curWrk];
+		MediaInfo& mInfo = *rw.mInfo;
+		
+		InitRenderPlayer(mInfo, rw.smplBuf);
+		mInfo._pbSongCnt = songList.size();
+		rw.thread = NULL;
+	}
+	
+	MakeOutputFileNames(outDir);
+	nextSong = 0;
+	errCnt = 0;
+	OSMutex_Init(&jobMutex, 0);
+	if (workers.size() > 1)
+		printf("Rendering with %u threads.\n", (unsigned)workers.size());
+	// worker 0 runs in the main thread
+	for (curWrk = 1; curWrk < workers.size(); curWrk ++)
+	{
+		retVal = OSThread_Init(&workers[curWrk].thread, RenderWorkerThread, &workers[curWrk]);
+		if (retVal)
+			workers[curWrk].thread = NULL;	// the remaining workers will do the job
+	}
+	RenderWorkerThread(&workers[0]);
+	for (curWrk = 1; curWrk < workers.size(); curWrk ++)
+	{
+		if (workers[curWrk].thread == NULL)
+			continue;
+		OSThread_Join(workers[curWrk].thread);
+		OSThread_Deinit(workers[curWrk].thread);
+	}
+	OSMutex_Deinit(jobMutex);	jobMutex = NULL;
+	printf("Rendered %u of %u songs.\n", (unsigned)(songList.size() - errCnt), (unsigned)songList.size());
+	
+	for (curWrk = 0; curWrk < workers.size(); curWrk ++)
+	{
+		DeinitRenderPlayer(*workers[curWrk].mInfo);
+		delete workers[curWrk].mInfo;
+	}
+	Loaders_Deinit();
+	outFileNames.clear();
+	
+	return errCnt ? 1 : 0;
+}
+
+UINT8 StreamRenderMain(FILE* hFile, bool rawPCM)
+{
+	MediaInfo* mInfo = new MediaInfo;	// allocated on the heap, because the chip options are large
+	GeneralOptions& genOpts = mInfo->_genOpts;
+	std::vector<UINT8> smplBuf;
+	WavWriter pcmOut;
+	size_t curSong;
+	size_t failCnt;
+	UINT8 retVal;
+	
+	ParseConfiguration(genOpts, 0x100, mInfo->_chipOpts, playerCfg);
+	if (! genOpts.maxLoops)
+		genOpts.maxLoops = 1;	// infinite looping would never end the stream
+	Loaders_Init();
+	Loaders_SetAuxCacheSize((UINT64)genOpts.auxCacheSize << 20);
+	InitRenderPlayer(*mInfo, smplBuf);
+	mInfo->_pbSongCnt = songList.size();
+	
+	// Collect the data into large blocks, so that there is one write() per MB instead of one per Render() call.
+	// The writes block while the reader is busy, so we render exactly as fast as the data is consumed.
+	setvbuf(hFile, NULL, _IOFBF, 0x100000);
+	retVal = pcmOut.OpenStream(hFile, mInfo->_player.GetSampleRate(), RENDER_CHANNELS,
+		SmplFmt_GetBits(genOpts.smplFmt), genOpts.smplFmt == SMPLFMT_F32, rawPCM);
+	streamOut = &pcmOut;
+	failCnt = 0;
+	for (curSong = 0; curSong < songList.size() && ! retVal; curSong ++)
+	{
+		u8printf("[%*u/%u] %s\n", count_digits((int)songList.size()), 1 + (unsigned)curSong,
+			(unsigned)songList.size(), songList[curSong].fileName.c_str());
+		fflush(stdout);
+		retVal = RenderSong(*mInfo, curSong, std::string(), smplBuf);
+		if (retVal == 0x10)
+			printf("Error writing the output stream - stopping.\n");
+		else if (retVal)
+			failCnt ++;
+		retVal = (retVal == 0x10);
+	}
+	streamOut = NULL;
+	pcmOut.Close();
+	fclose(hFile);
+	
+	DeinitRenderPlayer(*mInfo);
+	delete mInfo;
+	Loaders_Deinit();
+	
+	return (retVal || failCnt) ? 1 : 0;
+}
+
+static void RenderWorkerThread(void* args)
+{
+	RenderWorker* rw = (RenderWorker*)args;
+	
+	while(true)
+	{
+		size_t curSong;
+		std::string outFName;
+		UINT8 retVal;
+		
+		OSMutex_Lock(jobMutex);
+		curSong = nextSong;
+		if (curSong < songList.size())
+			nextSong ++;
+		OSMutex_Unlock(jobMutex);
+		if (curSong >= songList.size())
+			break;
+		
+		outFName = outFileNames[curSong];
+		u8printf("[%*u/%u] %s\n", count_digits((int)songList.size()), 1 + (unsigned)curSong,
+			(unsigned)songList.size(), outFName.c_str());
+		fflush(stdout);
+		retVal = RenderSong(*rw->mInfo, curSong, outFName, rw->smplBuf);
+		if (retVal)
+		{
+			OSMutex_Lock(jobMutex);
+			errCnt ++;
+			OSMutex_Unlock(jobMutex);
+		}
+	}
+	
+	return;
+}
+
+static void InitRenderPlayer(MediaInfo& mInfo, std::vector<UINT8>& smplBuf)
+{
+	PlayerA& player = mInfo._player;
+	const GeneralOptions& genOpts = mInfo._genOpts;
+	
+	player.RegisterPlayerEngine(new VGMPlayer);
+	player.RegisterPlayerEngine(new S98Player);
+	player.RegisterPlayerEngine(new DROPlayer);
+	player.SetEventCallback(RenderPlayCallback, &mInfo);
+	player.SetFileReqCallback(PlayerFileReqCallback, &mInfo._songPath);	// for files inside archives
+	ApplyCfg_General(player, genOpts);
+	for (size_t curChp = 0; curChp < 0x100; curChp ++)
+	{
+		const ChipOptions& cOpt = mInfo._chipOpts[curChp];
+		if (cOpt.chipType == 0xFF)
+			continue;
+		ApplyCfg_Chip(player, genOpts, cOpt);
+	}
+	mInfo._enableAlbumImage = false;
+	mInfo._playState = 0x00;
+	
+	// quarter of a second per Render() call, same as the local buffer of the player
+	// (float output is rendered as 32-bit integer and converted afterwards)
+	UINT8 smplBits = SmplFmt_GetBits(genOpts.smplFmt);
+	smplBuf.resize(genOpts.smplRate / 4 * RENDER_CHANNELS * smplBits / 8);
+	player.SetOutputSettings(genOpts.smplRate, RENDER_CHANNELS, smplBits,
+		(UINT32)(smplBuf.size() / (RENDER_CHANNELS * smplBits / 8)));
+	return;
+}
+
+static void DeinitRenderPlayer(MediaInfo& mInfo)
+{
+	mInfo._player.UnregisterAllPlayers();
+	return;
+}
+
+static UINT8 RenderSong(MediaInfo& mInfo, size_t songIdx, const std::string& outFileName, std::vector<UINT8>& smplBuf)
+{
+	PlayerA& player = mInfo._player;
+	const GeneralOptions& genOpts = mInfo._genOpts;
+	const SongFileList& sfl = songList[songIdx];
+	DATA_LOADER* dLoad;
+	UINT8 retVal;
+	UINT8 resVal;
+	UINT32 timeMS;
+	
+	dLoad = GetFileLoaderUTF8(sfl.fileName);
+	if (dLoad == NULL)
+		return 0xFF;
+	DataLoader_SetPreloadBytes(dLoad, 0x100);
+	retVal = DataLoader_Load(dLoad);
+	if (retVal)
+	{
+		DataLoader_CancelLoading(dLoad);
+		DataLoader_Deinit(dLoad);
+		u8printf("%s: Error 0x%02X opening file!\n", GetFileTitle(sfl.fileName.c_str()), retVal);
+		return 0xFF;
+	}
+	retVal = player.LoadFile(dLoad);
+	if (retVal)
+	{
+		DataLoader_CancelLoading(dLoad);
+		DataLoader_Deinit(dLoad);
+		u8printf("%s: Unknown file format! (Error 0x%02X)\n", GetFileTitle(sfl.fileName.c_str()), retVal);
+		return 0xFF;
+	}
+	
+	mInfo._pbSongID = songIdx;
+	mInfo._songPath = sfl.fileName;
+	mInfo._playlistTrkID = sfl.playlistSongID;
+	mInfo._fileEndPos = player.GetFileSize();
+	mInfo.PreparePlayback();
+	
+	// same settings as for playback
+	player.SetMasterVolume((INT32)(0x10000 * mInfo._volGain * genOpts.volume + 0.5));
+	timeMS = (player.GetPlayer()->GetLoopTicks() == 0) ? genOpts.pauseTime_jingle : genOpts.pauseTime_loop;
+	player.SetEndSilenceSamples(MSec2Samples(timeMS, player));
+	
+	player.Start();
+	if (streamOut != NULL)
+		resVal = RenderToWriter(mInfo, songIdx, *streamOut, smplBuf) ? 0x10 : 0x00;
+	else if (genOpts.renderStems)
+		resVal = RenderStems(mInfo, songIdx, outFileName, smplBuf);
+	else
+		resVal = RenderToFile(mInfo, songIdx, outFileName, smplBuf);
+	player.Stop();
+	
+	player.UnloadFile();
+	DataLoader_Deinit(dLoad);
+	
+	return resVal;
+}
+
+// The players mix all devices internally, so the output of a single device can't be tapped.
+// Instead the song is rendered once per device with all other devices disabled.
+// Disabled devices aren't emulated, so every device is emulated only once in total
+// and only the (cheap) command processing is repeated.
+static UINT8 RenderStems(MediaInfo& mInfo, size_t songIdx, const std::string& outFileName, std::vector<UINT8>& smplBuf)
+{
+	PlayerA& player = mInfo._player;
+	PlayerBase* pBase = player.GetPlayer();
+	std::vector<PLR_DEV_INFO> diList;
+	std::vector<PLR_MUTE_OPTS> muteOpts;
+	size_t curDev;
+	size_t curStem;
+	UINT8 resVal;
+	
+	pBase->GetSongDeviceInfo(diList);
+	muteOpts.resize(diList.size());
+	for (curDev = 0; curDev < diList.size(); curDev ++)
+		pBase->GetDeviceMuting(diList[curDev].id, muteOpts[curDev]);
+	
+	resVal = 0x00;
+	for (curStem = 0; curStem < diList.size() && ! resVal; curStem ++)
+	{
+		// disabled devices from the configuration stay disabled, but get an (empty) file nonetheless
+		for (curDev = 0; curDev < diList.size(); curDev ++)
+		{
+			PLR_MUTE_OPTS mOpts = muteOpts[curDev];
+			if (curDev != curStem)
+				mOpts.disable = 0xFF;
+			pBase->SetDeviceMuting(diList[curDev].id, mOpts);
+		}
+		player.Reset();
+		resVal = RenderToFile(mInfo, songIdx, GetStemFileName(outFileName, curStem, diList[curStem]), smplBuf);
+	}
+	for (curDev = 0; curDev < diList.size(); curDev ++)
+		pBase->SetDeviceMuting(diList[curDev].id, muteOpts[curDev]);
+	
+	return resVal;
+}
+
+static UINT8 RenderToFile(MediaInfo& mInfo, size_t songIdx, const std::string& outFileName, std::vector<UINT8>& smplBuf)
+{
+	const GeneralOptions& genOpts = mInfo._genOpts;
+	WavWriter wavOut;
+	UINT8 retVal;
+	UINT8 resVal;
+	
+	retVal = wavOut.Open(outFileName, mInfo._player.GetSampleRate(), RENDER_CHANNELS,
+		SmplFmt_GetBits(genOpts.smplFmt), genOpts.smplFmt == SMPLFMT_F32);
+	if (retVal)
+	{
+		u8printf("%s: Error 0x%02X creating output file!\n", GetFileTitle(outFileName.c_str()), retVal);
+		return 0xFF;
+	}
+	
+	resVal = RenderToWriter(mInfo, songIdx, wavOut, smplBuf);
+	retVal = wavOut.Close();
+	if (resVal || retVal)
+	{
+		u8printf("%s: Error writing output file!\n", GetFileTitle(outFileName.c_str()));
+		resVal = 0x01;
+	}
+	
+	return resVal;
+}
+
+// returns 0x01 when writing failed
+static UINT8 RenderToWriter(MediaInfo& mInfo, size_t songIdx, WavWriter& wavOut, std::vector<UINT8>& smplBuf)
+{
+	PlayerA& player = mInfo._player;
+	const GeneralOptions& genOpts = mInfo._genOpts;
+	UINT8 resVal;
+	UINT32 timeMS;
+	bool rawLogFade;
+	
+	timeMS = (songIdx + 1 == songList.size()) ? genOpts.fadeTime_single : genOpts.fadeTime_plist;
+	player.SetFadeSamples(MSec2Samples(timeMS, player));
+	
+	resVal = 0x00;
+	rawLogFade = (genOpts.fadeRawLogs && mInfo._isRawLog && genOpts.fadeTime_single > 0);
+	mInfo._playState = PLAYSTATE_PLAY;
+	while(! (mInfo._playState & PLAYSTATE_END))
+	{
+		if (rawLogFade && ! (player.GetState() & PLAYSTATE_FADE))
+		{
+			double fadeStart = player.GetTotalTime(1) - genOpts.fadeTime_single / 1500.0;
+			if (player.GetCurTime(1) >= fadeStart)
+			{
+				player.SetFadeSamples(MSec2Samples(genOpts.fadeTime_single, player));
+				player.FadeOut();
+				rawLogFade = false;
+			}
+		}
+		
+		UINT32 wrtBytes = player.Render((UINT32)smplBuf.size(), &smplBuf[0]);
+		if (! wrtBytes)
+			break;
+		if (genOpts.smplFmt == SMPLFMT_F32)
+			ConvertS32ToFloat(&smplBuf[0], wrtBytes);
+		if (wavOut.Write(&smplBuf[0], wrtBytes))
+		{
+			resVal = 0x01;
+			break;
+		}
+	}
+	mInfo._playState = 0x00;
+	
+	return resVal;
+}
+
+// Songs with the same file title (e.g. "a/title.vgm" and "b/title.vgz") would overwrite each other's file,
+// so they get the song number appended: "title_2.wav", "title_5.wav"
+// Names are compared case-insensitively, because the output directory may be on such a file system.
+static void MakeOutputFileNames(const std::string& outDir)
+{
+	std::vector<std::string> titles(songList.size());
+	std::map<std::string, size_t> titleCnt;	// lower-case title -> number of songs
+	std::set<std::string> usedNames;
+	size_t curSong;
+	
+	for (curSong = 0; curSong < songList.size(); curSong ++)
+	{
+		titles[curSong] = GetOutputFileTitle(songList[curSong].fileName);
+		titleCnt[LowerCaseStr(titles[curSong])] ++;
+	}
+	for (curSong = 0; curSong < songList.size(); curSong ++)
+	{
+		if (titleCnt[LowerCaseStr(titles[curSong])] == 1)
+			usedNames.insert(LowerCaseStr(titles[curSong]));
+	}
+	
+	outFileNames.resize(songList.size());
+	for (curSong = 0; curSong < songList.size(); curSong ++)
+	{
+		std::string title = titles[curSong];
+		if (titleCnt[LowerCaseStr(title)] > 1)
+		{
+			char numStr[0x10];
+			sprintf(numStr, "_%u", 1 + (unsigned)curSong);
+			do
+			{
+				title += numStr;	// "title_2_2" in the unlikely case that "title_2" is another song
+			} while(usedNames.find(LowerCaseStr(title)) != usedNames.end());
+			usedNames.insert(LowerCaseStr(title));
+			u8printf("Warning: Multiple songs are named %s, writing %s as %s.wav.\n",
+				titles[curSong].c_str(), songList[curSong].fileName.c_str(), title.c_str());
+		}
+		outFileNames[curSong] = CombinePaths(outDir, title + ".wav");
+	}
+	
+	return;
+}
+
+static std::string GetOutputFileTitle(const std::string& songFileName)
+{
+	const char* fileTitle = GetFileTitle(songFileName.c_str());
+	const char* extPtr = GetFileExtension(fileTitle);
+	
+	return (extPtr != NULL) ? std::string(fileTitle, extPtr - 1) : std::string(fileTitle);
+}
+
+static std::string LowerCaseStr(std::string str)
+{
+	size_t curChr;
+	
+	for (curChr = 0; curChr < str.length(); curChr ++)
+		str[curChr] = (char)tolower((unsigned char)str[curChr]);
+	return str;
+}
+
+// "song.wav" -> "song_01_YM2612.wav"
+static std::string GetStemFileName(const std::string& outFileName, size_t devIdx, const PLR_DEV_INFO& pdi)
+{
+	std::string baseName = outFileName.substr(0, outFileName.length() - 4);	// remove ".wav"
+	std::string devName = SndEmu_GetDevName(pdi.type, 0x00, pdi.devCfg);
+	char idxStr[0x10];
+	size_t curChr;
+	
+	for (curChr = 0; curChr < devName.length(); curChr ++)
+	{
+		char c = devName[curChr];
+		if (! isalnum((unsigned char)c) && c != '-')
+			devName[curChr] = '_';	// make it safe for file names
+	}
+	sprintf(idxStr, "_%02u_", 1 + (unsigned)devIdx);
+	return baseName + idxStr + devName + ".wav";
+}
+
+static void ConvertS32ToFloat(void* buffer, UINT32 bytes)
+{
+	// in-place, float and INT32 have the same size
+	const INT32* srcPtr = (const INT32*)buffer;
+	float* dstPtr = (float*)buffer;
+	UINT32 smplCnt = bytes / sizeof(INT32);
+	UINT32 curSmpl;
+	
+	for (curSmpl = 0; curSmpl < smplCnt; curSmpl ++)
+		dstPtr[curSmpl] = srcPtr[curSmpl] / 2147483648.0f;
+	return;
+}
+
+static UINT8 CreateOutputDir(const std::string& dirPath)
+{
+	int retVal;
+	
+#ifdef _WIN32
+	retVal = _mkdir(dirPath.c_str());
+#else
+	retVal = mkdir(dirPath.c_str(), 0777);
+#endif
+	if (retVal && errno != EEXIST)
+		return 0xFF;
+	return 0x00;
+}
+
+static UINT8 RenderPlayCallback(PlayerBase* player, void* userParam, UINT8 evtType, void* evtParam)
+{
+	MediaInfo* mInfo = (MediaInfo*)userParam;
+	
+	if (evtType == PLREVT_END)
+		mInfo->_playState |= PLAYSTATE_END;
+	return 0x00;
+}
@@ -0,0 +1,16 @@
+#ifndef __BATCHRENDER_HPP__
+#define __BATCHRENDER_HPP__
+
+#include <stdio.h>
+#include <stdtype.h>
+#include <string>
+
+// Render all songs of the song list to WAV files in outDir as fast as possible.
+// No audio devices, no key handling, no terminal changes.
+// With RenderStems enabled, there is one file per sound chip instead of the mix.
+UINT8 BatchRenderMain(const std::string& outDir);
+// Render all songs as one continuous stream of raw PCM or WAV data to hFile (usually stdout).
+// Nothing else may be printed to hFile.
+UINT8 StreamRenderMain(FILE* hFile, bool rawPCM);
+
+#endif	// __BATCHRENDER_HPP__
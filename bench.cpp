@@ -0,0 +1,389 @@
+// vgmplay-bench: measures how fast songs are rendered with the current configuration
+// Output is discarded. This is meant for comparing emulation cores and resampling settings.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <vector>
+#include <string>
+
+#include <getopt.h>
+
+#include <stdtype.h>
+#include <utils/DataLoader.h>
+#include <player/playerbase.hpp>
+#include <player/s98player.hpp>
+#include <player/droplayer.hpp>
+#include <player/vgmplayer.hpp>
+#include <player/playera.hpp>
+#include <emu/SoundEmu.h>	// for SndEmu_GetDevName()
+
+#include "utils.hpp"
+#include "config.hpp"
+#include "appcfg.hpp"
+#include "m3uargparse.hpp"
+#include "playcfg.hpp"
+#include "loaders.hpp"
+#include "version.h"
+
+
+struct ChipCost
+{
+	std::string name;
+	double load;	// emulation time in percent of the realtime budget
+};
+struct BenchResult
+{
+	double loadTime;	// opening + loading + starting the player, in seconds
+	double renderTime;	// in seconds
+	UINT32 smplCount;	// rendered samples
+	std::vector<ChipCost> chips;	// only with --per-chip
+};
+
+
+static void PrintHelp(const char* appName);
+static int ParseArguments(int argc, char* argv[], Configuration& argCfg);
+static void InitBenchPlayer(PlayerA& player);
+static UINT8 BenchSong(PlayerA& player, const std::string& fileName, BenchResult& result);
+static double RenderPass(PlayerA& player, UINT32 smplTarget, UINT32& smplCount);
+static void MeasureChipCosts(PlayerA& player, UINT32 smplTarget, std::vector<ChipCost>& chips);
+static std::string GetChipName(const PLR_DEV_INFO& pdi);
+static UINT8 BenchPlayCallback(PlayerBase* player, void* userParam, UINT8 evtType, void* evtParam);
+
+
+#define BENCH_CHANNELS	2
+#define BENCH_BITS		16
+
+       std::vector<std::string> appSearchPaths;
+static std::string cfgFilePath;
+static Configuration benchCfg;
+static UINT32 benchTime = 60;	// render time per song in seconds
+static bool perChipCost = false;
+
+static std::vector<SongFileList> songList;
+static std::vector<PlaylistFileList> plList;
+
+static GeneralOptions genOpts;
+static ChipOptions chipOpts[0x100];
+static std::vector<UINT8> smplBuf;
+static volatile bool songEnd;
+
+int main(int argc, char* argv[])
+{
+	Configuration argCfg;
+	int argbase;
+	UINT8 retVal;
+	PlayerA player;
+	double totalTime;
+	UINT64 totalSmpls;
+	size_t okCnt;
+	
+	setlocale(LC_ALL, "");
+	setlocale(LC_NUMERIC, "C");
+	
+	argbase = ParseArguments(argc, argv, argCfg);
+	if (argbase == 0)
+		return 0;
+	else if (argbase < 0)
+		return 1;
+	if (argbase >= argc)
+	{
+		PrintHelp(argv[0]);
+		return 1;
+	}
+	
+	InitAppSearchPaths(argv[0], appSearchPaths);
+	if (cfgFilePath.empty())
+	{
+		std::vector<std::string> cfgFileNames;
+		cfgFileNames.push_back("VGMPlay.ini");
+		cfgFileNames.push_back("vgmplay.ini");
+		cfgFilePath = FindFile_List(cfgFileNames, appSearchPaths);
+	}
+	if (cfgFilePath.empty())
+	{
+		fprintf(stderr, "VGMPlay.ini not found - using default settings.\n");
+	}
+	else
+	{
+		retVal = LoadConfig(cfgFilePath, benchCfg);
+		if (retVal & 0x80)
+		{
+			fprintf(stderr, "Unable to read %s!\n", cfgFilePath.c_str());
+			return 1;
+		}
+		u8printf("Configuration:  %s\n", cfgFilePath.c_str());
+	}
+	benchCfg += argCfg;	// command line options override INI settings
+	
+	retVal = ParseSongFiles(std::vector<const char*>(argv + argbase, argv + argc), songList, plList);
+	if (retVal)
+		fprintf(stderr, "One or more playlists couldn't be read!\n");
+	if (songList.empty())
+	{
+		fprintf(stderr, "No songs to render.\n");
+		return 1;
+	}
+	
+	ParseConfiguration(genOpts, 0x100, chipOpts, benchCfg);
+	genOpts.maxLoops = 0;	// loop forever, so that every song gets rendered for the full time
+	printf("Sample Rate:    %u Hz, ResamplingMode %u, ChipSmplMode %u\n",
+		genOpts.smplRate, genOpts.resmplMode, genOpts.chipSmplMode);
+	printf("Time per Song:  %u s\n\n", benchTime);
+	
+	Loaders_Init();
+	InitBenchPlayer(player);
+	
+	printf("%8s %10s %12s %9s  %s\n", "Load [s]", "Render [s]", "Samples/s", "Realtime", "File");
+	totalTime = 0.0;
+	totalSmpls = 0;
+	okCnt = 0;
+	for (size_t curSong = 0; curSong < songList.size(); curSong ++)
+	{
+		const std::string& fileName = songList[curSong].fileName;
+		BenchResult res;
+		
+		retVal = BenchSong(player, fileName, res);
+		if (retVal)
+			continue;
+		
+		double smplRate = (res.renderTime > 0.0) ? res.smplCount / res.renderTime : 0.0;
+		u8printf("%8.3f %10.3f %12.0f %8.2fx  %s\n", res.loadTime, res.renderTime, smplRate,
+			smplRate / genOpts.smplRate, fileName.c_str());
+		for (size_t curChip = 0; curChip < res.chips.size(); curChip ++)
+			printf("    %-28s %6.1f %% of realtime\n", res.chips[curChip].name.c_str(), res.chips[curChip].load);
+		fflush(stdout);
+		totalTime += res.renderTime;
+		totalSmpls += res.smplCount;
+		okCnt ++;
+	}
+	if (okCnt > 0 && totalTime > 0.0)
+	{
+		double smplRate = totalSmpls / totalTime;
+		printf("\nTotal: %u songs, %.3f s rendering, %.0f samples/s, %.2fx realtime\n",
+			(unsigned)okCnt, totalTime, smplRate, smplRate / genOpts.smplRate);
+	}
+	
+	player.UnregisterAllPlayers();
+	Loaders_Deinit();
+	
+	return (okCnt == songList.size()) ? 0 : 1;
+}
+
+static void PrintHelp(const char* appName)
+{
+	printf("VGMPlay Benchmark %s\n", VGMPLAY_VER_STR);
+	printf("Usage: %s [options] file1.vgm [file2.s98] [list.m3u] [...]\n", appName);
+	printf("    -h, --help              show this help screen\n");
+	printf("    -t, --time secs         render time per song (default: 60)\n");
+	printf("    -i, --ini file          use this configuration file instead of VGMPlay.ini\n");
+	printf("    -c, --config option     set configuration option, format: section.key=Data\n");
+	printf("    -p, --per-chip          measure the emulation cost of each sound chip (renders every song once per chip)\n");
+	return;
+}
+
+static int ParseArguments(int argc, char* argv[], Configuration& argCfg)
+{
+	static const struct option LONG_OPTS[] =
+	{
+		{"help",   no_argument,       NULL, 'h'},
+		{"time",   required_argument, NULL, 't'},
+		{"ini",    required_argument, NULL, 'i'},
+		{"config", required_argument, NULL, 'c'},
+		{"per-chip", no_argument,     NULL, 'p'},
+		{NULL, 0, NULL, 0}
+	};
+	
+	optind = 1;
+	while(true)
+	{
+		int retVal = getopt_long(argc, argv, "ht:i:c:p", LONG_OPTS, NULL);
+		if (retVal == -1)
+			break;	// finished argument parsing
+		else if (retVal == '?')
+			return -1;
+		
+		switch(retVal)
+		{
+		case 'h':
+			PrintHelp(argv[0]);
+			return 0;
+		case 't':
+			benchTime = (UINT32)strtoul(optarg, NULL, 0);
+			if (! benchTime)
+				benchTime = 1;
+			break;
+		case 'i':
+			cfgFilePath = optarg;
+			break;
+		case 'p':
+			perChipCost = true;
+			break;
+		case 'c':	// configuration setting
+			AddConfigOption(argCfg, optarg);
+			break;
+		}
+	}
+	
+	return optind;
+}
+
+static void InitBenchPlayer(PlayerA& player)
+{
+	player.RegisterPlayerEngine(new VGMPlayer);
+	player.RegisterPlayerEngine(new S98Player);
+	player.RegisterPlayerEngine(new DROPlayer);
+	player.SetEventCallback(BenchPlayCallback, NULL);
+	player.SetFileReqCallback(PlayerFileReqCallback, NULL);
+	ApplyCfg_General(player, genOpts);
+	for (size_t curChp = 0; curChp < 0x100; curChp ++)
+	{
+		const ChipOptions& cOpt = chipOpts[curChp];
+		if (cOpt.chipType == 0xFF)
+			continue;
+		ApplyCfg_Chip(player, genOpts, cOpt);
+	}
+	
+	// quarter of a second per Render() call, same as batch rendering
+	smplBuf.resize(genOpts.smplRate / 4 * BENCH_CHANNELS * BENCH_BITS / 8);
+	player.SetOutputSettings(genOpts.smplRate, BENCH_CHANNELS, BENCH_BITS,
+		(UINT32)(smplBuf.size() / (BENCH_CHANNELS * BENCH_BITS / 8)));
+	return;
+}
+
+static UINT8 BenchSong(PlayerA& player, const std::string& fileName, BenchResult& result)
+{
+	DATA_LOADER* dLoad;
+	UINT8 retVal;
+	UINT32 smplTarget;
+	double startTime;
+	double renderStart;
+	
+	startTime = GetMonotonicTime();
+	dLoad = GetFileLoaderUTF8(fileName);
+	if (dLoad == NULL)
+		return 0xFF;
+	DataLoader_SetPreloadBytes(dLoad, 0x100);
+	retVal = DataLoader_Load(dLoad);
+	if (retVal)
+	{
+		DataLoader_CancelLoading(dLoad);
+		DataLoader_Deinit(dLoad);
+		u8printf("%s: Error 0x%02X opening file!\n", fileName.c_str(), retVal);
+		return 0xFF;
+	}
+	retVal = player.LoadFile(dLoad);
+	if (retVal)
+	{
+		DataLoader_Deinit(dLoad);
+		u8printf("%s: Unknown file format! (Error 0x%02X)\n", fileName.c_str(), retVal);
+		return 0xFF;
+	}
+	// no fading, no volume changes - just the cost of the emulation
+	player.SetFadeSamples(0);
+	player.SetEndSilenceSamples(0);
+	player.Start();
+	renderStart = GetMonotonicTime();
+	result.loadTime = renderStart - startTime;
+	
+	smplTarget = benchTime * player.GetSampleRate();
+	result.renderTime = RenderPass(player, smplTarget, result.smplCount);
+	result.chips.clear();
+	if (perChipCost)
+		MeasureChipCosts(player, smplTarget, result.chips);
+	
+	player.Stop();
+	player.UnloadFile();
+	DataLoader_Deinit(dLoad);
+	
+	return 0x00;
+}
+
+// returns the time needed for rendering
+static double RenderPass(PlayerA& player, UINT32 smplTarget, UINT32& smplCount)
+{
+	const UINT32 smplSize = BENCH_CHANNELS * BENCH_BITS / 8;
+	double startTime = GetMonotonicTime();
+	
+	songEnd = false;
+	smplCount = 0;
+	while(smplCount < smplTarget && ! songEnd)
+	{
+		UINT32 bufSize = (UINT32)smplBuf.size();
+		if (bufSize / smplSize > smplTarget - smplCount)
+			bufSize = (smplTarget - smplCount) * smplSize;
+		UINT32 wrtBytes = player.Render(bufSize, &smplBuf[0]);
+		if (! wrtBytes)
+			break;
+		smplCount += wrtBytes / smplSize;
+	}
+	return GetMonotonicTime() - startTime;
+}
+
+// The players can't time single devices, so the song is rendered again with all devices disabled
+// and then once for each device with only that one enabled.
+// The difference to the run without devices is the cost of the device.
+static void MeasureChipCosts(PlayerA& player, UINT32 smplTarget, std::vector<ChipCost>& chips)
+{
+	PlayerBase* pBase = player.GetPlayer();
+	std::vector<PLR_DEV_INFO> diList;
+	std::vector<PLR_MUTE_OPTS> muteOpts;
+	size_t curDev;
+	size_t curChip;
+	UINT32 smplCount;
+	double baseLoad;
+	
+	pBase->GetSongDeviceInfo(diList);
+	muteOpts.resize(diList.size());
+	for (curDev = 0; curDev < diList.size(); curDev ++)
+		pBase->GetDeviceMuting(diList[curDev].id, muteOpts[curDev]);
+	
+	chips.resize(diList.size() + 1);
+	for (curChip = 0; curChip <= diList.size(); curChip ++)
+	{
+		// curChip == 0: no devices (mixing and resampling overhead), else only device (curChip - 1)
+		for (curDev = 0; curDev < diList.size(); curDev ++)
+		{
+			PLR_MUTE_OPTS mOpts = muteOpts[curDev];
+			if (curDev + 1 != curChip)
+				mOpts.disable = 0xFF;
+			pBase->SetDeviceMuting(diList[curDev].id, mOpts);
+		}
+		player.Reset();
+		double renderTime = RenderPass(player, smplTarget, smplCount);
+		chips[curChip].load = smplCount ? (100.0 * renderTime / ((double)smplCount / player.GetSampleRate())) : 0.0;
+		chips[curChip].name = curChip ? GetChipName(diList[curChip - 1]) : "(player, no chips)";
+	}
+	for (curDev = 0; curDev < diList.size(); curDev ++)
+		pBase->SetDeviceMuting(diList[curDev].id, muteOpts[curDev]);
+	
+	baseLoad = chips[0].load;
+	for (curChip = 1; curChip < chips.size(); curChip ++)
+	{
+		chips[curChip].load -= baseLoad;
+		if (chips[curChip].load < 0.0)
+			chips[curChip].load = 0.0;	// measurement noise
+	}
+	return;
+}
+
+static std::string GetChipName(const PLR_DEV_INFO& pdi)
+{
+	std::string name = SndEmu_GetDevName(pdi.type, 0x01, pdi.devCfg);
+	char coreStr[5];
+	
+	coreStr[0] = (char)((pdi.core >> 24) & 0xFF);
+	coreStr[1] = (char)((pdi.core >> 16) & 0xFF);
+	coreStr[2] = (char)((pdi.core >>  8) & 0xFF);
+	coreStr[3] = (char)((pdi.core >>  0) & 0xFF);
+	coreStr[4] = '\0';
+	return name + " (" + coreStr + ")";
+}
+
+static UINT8 BenchPlayCallback(PlayerBase* player, void* userParam, UINT8 evtType, void* evtParam)
+{
+	if (evtType == PLREVT_END)
+		songEnd = true;	// only happens for songs without loop
+	return 0x00;
+}
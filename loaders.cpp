@@ -0,0 +1,1146 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include <stdtype.h>
+#include <utils/DataLoader.h>
+#include <utils/FileLoader.h>
+#include <utils/StrUtils.h>
+#include <utils/OSMutex.h>
+#include <utils/OSSignal.h>
+#include <utils/OSThread.h>
+#include <player/playerbase.hpp>
+#include <zlib.h>
+
+#include "utils.hpp"
+#include "loaders.hpp"
+#include "ziparchive.hpp"
+#include "spscring.hpp"	// for AtomicLoadAcq/AtomicStoreRel
+
+
+// Files are mapped into memory. Their pages come from the OS page cache, so they are loaded on demand
+// and shared with other processes that play the same file.
+struct FILE_MAPPING
+{
+	const UINT8* data;
+	UINT32 size;
+#ifdef _WIN32
+	HANDLE hMap;
+#endif
+};
+
+// uncompressed files: read directly from the mapping
+struct MMAP_LOADER
+{
+	FILE_MAPPING map;
+	UINT32 pos;
+	UINT32 skipStart;	// [skipStart, skipEnd) reads as zeros without touching the mapping
+	UINT32 skipEnd;
+};
+
+// gzip-compressed files: A thread inflates the mapped file in chunks, starting when the loader is opened.
+// Reads wait only when they get ahead of the decompression.
+// When the size in the gzip trailer can't be trusted, all members are inflated into a growing buffer
+// and the loader waits for the end of the decompression before it reports the size.
+struct GZ_LOADER
+{
+	FILE_MAPPING map;
+	UINT8* data;
+	UINT32 size;	// uncompressed size
+	UINT32 bufSize;	// allocated size of data
+	bool sizeKnown;	// true = size is from the trailer, false = size is set by the thread when it is done
+	volatile UINT32 avail;	// bytes that were inflated so far
+	volatile bool done;
+	volatile bool stop;	// set by the loader when it is deinitialized
+	OS_THREAD* thread;
+	OS_SIGNAL* signal;	// set after every chunk
+	UINT32 pos;
+};
+
+#define GZ_CHUNK_SIZE	0x40000	// 256 KB
+#define GZ_TRAILER_MAX	0x10000000	// 256 MB, larger sizes in the trailer aren't trusted
+#define GZ_MAX_RATIO	1032	// deflate can't compress better than this
+
+// files requested by the players (e.g. sample ROMs) are kept in memory for the next song that needs them
+struct AUX_FILE
+{
+	std::string path;
+	UINT64 mtime;
+	UINT64 fileSize;
+	std::vector<UINT8> data;
+	UINT32 refCnt;	// number of loaders that read from this file
+	UINT32 lastUse;
+	bool cached;	// false = removed from the cache, deleted when the last loader is done
+};
+
+struct AUXREF_LOADER
+{
+	AUX_FILE* file;
+	UINT32 pos;
+};
+
+static bool MapFileU8(const std::string& fileNameU8, FILE_MAPPING& fMap);
+static void UnmapFile(FILE_MAPPING& fMap);
+static DATA_LOADER* MappedLoader_InitU8(const std::string& fileNameU8);
+static bool VGM_GetCommandRange(const FILE_MAPPING& fMap, UINT32& startOfs, UINT32& endOfs);
+static inline UINT32 ReadLE32(const UINT8* data);
+static UINT8 MMapLoader_dopen(void* context);
+static UINT32 MMapLoader_dread(void* context, UINT8* buffer, UINT32 numBytes);
+static UINT8 MMapLoader_dseek(void* context, UINT32 offset, UINT8 whence);
+static UINT8 MMapLoader_dclose(void* context);
+static INT32 MMapLoader_dtell(void* context);
+static UINT32 MMapLoader_dlength(void* context);
+static UINT8 MMapLoader_deof(void* context);
+static UINT8 MMapLoader_ddeinit(void* context);
+static UINT8 GzLoader_dopen(void* context);
+static UINT32 GzLoader_dread(void* context, UINT8* buffer, UINT32 numBytes);
+static UINT8 GzLoader_dseek(void* context, UINT32 offset, UINT8 whence);
+static UINT8 GzLoader_dclose(void* context);
+static INT32 GzLoader_dtell(void* context);
+static UINT32 GzLoader_dlength(void* context);
+static UINT8 GzLoader_deof(void* context);
+static UINT8 GzLoader_ddeinit(void* context);
+static void GzLoader_InflateThread(void* args);
+static void GzLoader_WaitDone(GZ_LOADER* gzLoader);
+static bool Gz_TrailerIsPlausible(const UINT8* gzData, UINT32 gzSize, UINT32 size);
+static DATA_LOADER* AuxCache_GetLoader(const std::string& filePath);
+static void AuxCache_Release(AUX_FILE* auxFile);
+static void AuxCache_Trim(void);
+static DATA_LOADER* ZipLoader_InitU8(const std::string& zipPath, const std::string& memberName);
+static UINT8 GunzipData(std::vector<UINT8>& data);
+static UINT8 AuxLoader_dopen(void* context);
+static UINT32 AuxLoader_dread(void* context, UINT8* buffer, UINT32 numBytes);
+static UINT8 AuxLoader_dseek(void* context, UINT32 offset, UINT8 whence);
+static UINT8 AuxLoader_dclose(void* context);
+static INT32 AuxLoader_dtell(void* context);
+static UINT32 AuxLoader_dlength(void* context);
+static UINT8 AuxLoader_deof(void* context);
+static UINT8 AuxLoader_ddeinit(void* context);
+
+static const DATA_LOADER_CALLBACKS mmapLoader =
+{
+	0x4D4D4150,		// "MMAP"
+	"Memory-Mapped File Loader",
+	MMapLoader_dopen,
+	MMapLoader_dread,
+	MMapLoader_dseek,
+	MMapLoader_dclose,
+	MMapLoader_dtell,
+	MMapLoader_dlength,
+	MMapLoader_deof,
+	MMapLoader_ddeinit,
+};
+
+static const DATA_LOADER_CALLBACKS gzLoader =
+{
+	0x475A4950,		// "GZIP"
+	"Threaded Gzip Loader",
+	GzLoader_dopen,
+	GzLoader_dread,
+	GzLoader_dseek,
+	GzLoader_dclose,
+	GzLoader_dtell,
+	GzLoader_dlength,
+	GzLoader_deof,
+	GzLoader_ddeinit,
+};
+
+static const DATA_LOADER_CALLBACKS auxLoader =
+{
+	0x41555846,		// "AUXF"
+	"Cached File Loader",
+	AuxLoader_dopen,
+	AuxLoader_dread,
+	AuxLoader_dseek,
+	AuxLoader_dclose,
+	AuxLoader_dtell,
+	AuxLoader_dlength,
+	AuxLoader_deof,
+	AuxLoader_ddeinit,
+};
+
+// shared by all players, batch mode renders with several threads
+static OS_MUTEX* auxCacheMtx = NULL;
+static std::vector<AUX_FILE*> auxCache;
+static UINT64 auxCacheBytes = 0;
+static UINT64 auxCacheMax = 32 << 20;
+static UINT32 auxUseCnt = 0;
+
+#ifdef _WIN32
+static CPCONV* cpcU8_Wide = NULL;
+#if ! HAVE_FILELOADER_W
+static CPCONV* cpcU8_ACP = NULL;
+#endif
+#endif
+
+extern std::vector<std::string> appSearchPaths;
+
+UINT8 Loaders_Init(void)
+{
+	UINT8 retVal = 0x00;
+#ifdef _WIN32
+	retVal = CPConv_Init(&cpcU8_Wide, "UTF-8", "UTF-16LE");
+#if ! HAVE_FILELOADER_W
+	{
+		std::string cpName(0x10, '\0');
+		snprintf(&cpName[0], cpName.size(), "CP%u", GetACP());
+		retVal = CPConv_Init(&cpcU8_ACP, "UTF-8", cpName.c_str());
+	}
+#endif
+#endif
+	if (auxCacheMtx == NULL)
+		OSMutex_Init(&auxCacheMtx, 0);
+	ZipArchive_Init();
+	return retVal;
+}
+
+void Loaders_Deinit(void)
+{
+#ifdef _WIN32
+	CPConv_Deinit(cpcU8_Wide);	cpcU8_Wide = NULL;
+#if ! HAVE_FILELOADER_W
+	CPConv_Deinit(cpcU8_ACP);	cpcU8_ACP = NULL;
+#endif
+#endif
+	if (auxCacheMtx != NULL)
+	{
+		// files that are still in use by a player are freed by their loader
+		size_t curFile;
+		OSMutex_Lock(auxCacheMtx);
+		for (curFile = 0; curFile < auxCache.size(); curFile ++)
+		{
+			AUX_FILE* auxFile = auxCache[curFile];
+			auxFile->cached = false;
+			if (! auxFile->refCnt)
+				delete auxFile;
+		}
+		auxCache.clear();
+		auxCacheBytes = 0;
+		OSMutex_Unlock(auxCacheMtx);
+	}
+	return;
+}
+
+void Loaders_SetAuxCacheSize(UINT64 maxBytes)
+{
+	auxCacheMax = maxBytes;
+	return;
+}
+
+UINT64 Loaders_PrefetchFile(const std::string& fileNameU8, UINT64 maxBytes, const volatile bool* cancel)
+{
+#if ! defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+	struct stat fileStat;
+	UINT64 prefetchSize;
+	int hFile;
+	
+	hFile = open(fileNameU8.c_str(), O_RDONLY);
+	if (hFile < 0)
+		return 0;
+	if (fstat(hFile, &fileStat) || ! S_ISREG(fileStat.st_mode))
+	{
+		close(hFile);
+		return 0;
+	}
+	prefetchSize = (UINT64)fileStat.st_size;
+	if (prefetchSize > maxBytes)
+		prefetchSize = maxBytes;
+	// The kernel reads the data in the background, closing the file doesn't cancel that.
+	posix_fadvise(hFile, 0, (off_t)prefetchSize, POSIX_FADV_WILLNEED);
+	close(hFile);
+	return prefetchSize;
+#else
+	// no read-ahead hint, read the file into the page cache ourselves
+	std::vector<UINT8> buffer(0x10000);
+	UINT64 readBytes;
+	FILE* hFile;
+#ifdef _WIN32
+	size_t fileNameWLen = 0;
+	wchar_t* fileNameWStr = NULL;
+	UINT8 retVal = CPConv_StrConvert(cpcU8_Wide, &fileNameWLen, reinterpret_cast<char**>(&fileNameWStr),
+		fileNameU8.length() + 1, fileNameU8.c_str());	// length()+1 to include the \0
+	hFile = (retVal < 0x80) ? _wfopen(fileNameWStr, L"rb") : NULL;
+	free(fileNameWStr);
+#else
+	hFile = fopen(fileNameU8.c_str(), "rb");
+#endif
+	if (hFile == NULL)
+		return 0;
+	readBytes = 0;
+	while(readBytes < maxBytes && ! *cancel)
+	{
+		size_t chunkSize = buffer.size();
+		if (chunkSize > maxBytes - readBytes)
+			chunkSize = (size_t)(maxBytes - readBytes);
+		chunkSize = fread(&buffer[0], 1, chunkSize, hFile);
+		if (! chunkSize)
+			break;
+		readBytes += chunkSize;
+	}
+	fclose(hFile);
+	return readBytes;
+#endif
+}
+
+DATA_LOADER* GetFileLoaderUTF8(const std::string& fileNameU8)
+{
+	std::string zipPath;
+	std::string memberName;
+	if (ZipPath_Split(fileNameU8, zipPath, memberName) && ! memberName.empty())
+	{
+		DATA_LOADER* zipLoad = ZipLoader_InitU8(zipPath, memberName);
+		if (zipLoad != NULL)
+			return zipLoad;
+		// not an archive, may be a directory called "*.zip"
+	}
+	
+	// FileLoader is used for files that can't be mapped
+	DATA_LOADER* mmLoad = MappedLoader_InitU8(fileNameU8);
+	if (mmLoad != NULL)
+		return mmLoad;
+	
+#ifndef _WIN32
+	return FileLoader_Init(fileNameU8.c_str());
+#else
+#if HAVE_FILELOADER_W
+	size_t fileNameWLen = 0;
+	wchar_t* fileNameWStr = NULL;
+	UINT8 retVal = CPConv_StrConvert(cpcU8_Wide, &fileNameWLen, reinterpret_cast<char**>(&fileNameWStr),
+		fileNameU8.length() + 1, fileNameU8.c_str());	// length()+1 to include the \0
+	DATA_LOADER* dLoad = NULL;
+	if (retVal < 0x80)
+		dLoad = FileLoader_InitW(fileNameWStr);
+	free(fileNameWStr);
+	return dLoad;
+#else
+	size_t fileNameALen = 0;
+	char* fileNameAStr = NULL;
+	UINT8 retVal = CPConv_StrConvert(cpcU8_ACP, &fileNameALen, &fileNameAStr,
+		fileNameU8.length() + 1, fileNameU8.c_str());	// length()+1 to include the \0
+	DATA_LOADER* dLoad = NULL;
+	if (retVal < 0x80)
+		dLoad = FileLoader_Init(fileNameAStr);
+	free(fileNameAStr);
+	return dLoad;
+#endif
+#endif
+}
+
+DATA_LOADER* GetSongInfoLoaderUTF8(const std::string& fileNameU8)
+{
+	std::string zipPath;
+	std::string memberName;
+	FILE_MAPPING fMap;
+	UINT32 skipStart;
+	UINT32 skipEnd;
+	
+	if (ZipPath_Split(fileNameU8, zipPath, memberName) && ! memberName.empty())
+		return GetFileLoaderUTF8(fileNameU8);
+	if (! MapFileU8(fileNameU8, fMap))
+		return GetFileLoaderUTF8(fileNameU8);
+	if (! VGM_GetCommandRange(fMap, skipStart, skipEnd))
+	{
+		UnmapFile(fMap);
+		return GetFileLoaderUTF8(fileNameU8);	// compressed or not a VGM
+	}
+	
+	DATA_LOADER* dLoader = (DATA_LOADER*)calloc(1, sizeof(DATA_LOADER));
+	if (dLoader == NULL)
+	{
+		UnmapFile(fMap);
+		return NULL;
+	}
+	MMAP_LOADER* mmLdr = new MMAP_LOADER;
+	mmLdr->map = fMap;
+	mmLdr->pos = 0;
+	mmLdr->skipStart = skipStart;
+	mmLdr->skipEnd = skipEnd;
+	DataLoader_Setup(dLoader, &mmapLoader, mmLdr);
+	return dLoader;
+}
+
+DATA_LOADER* PlayerFileReqCallback(void* userParam, PlayerBase* player, const char* fileName)
+{
+	std::string filePath;
+	const std::string* songPath = (const std::string*)userParam;
+	std::string zipPath;
+	std::string memberName;
+	if (songPath != NULL && ZipPath_Split(*songPath, zipPath, memberName))
+	{
+		// songs inside archives look for their files in the archive first, next to the song and then in the root
+		size_t sepPos = memberName.find_last_of("/\\");
+		std::string memberDir = (sepPos == std::string::npos) ? std::string() : memberName.substr(0, sepPos + 1);
+		if (! memberDir.empty() && ZipArchive_HasMember(zipPath, memberDir + fileName))
+			filePath = zipPath + "/" + memberDir + fileName;
+		else if (ZipArchive_HasMember(zipPath, fileName))
+			filePath = zipPath + "/" + fileName;
+	}
+	if (filePath.empty())
+		filePath = FindFile_Single(fileName, appSearchPaths);
+	if (filePath.empty())
+	{
+		fprintf(stderr, "Unable to find %s!\n", fileName);
+		return NULL;
+	}
+	//fprintf(stderr, "Player requested file - found at %s\n", filePath.c_str());
+
+	DATA_LOADER* dLoad = AuxCache_GetLoader(filePath);
+	if (dLoad == NULL)
+		dLoad = GetFileLoaderUTF8(filePath);	// not cacheable
+	if (dLoad == NULL)
+		return NULL;
+	UINT8 retVal = DataLoader_Load(dLoad);
+	if (! retVal)
+		return dLoad;
+	DataLoader_Deinit(dLoad);
+	return NULL;
+}
+
+static bool MapFileU8(const std::string& fileNameU8, FILE_MAPPING& fMap)
+{
+#ifdef _WIN32
+	size_t fileNameWLen = 0;
+	wchar_t* fileNameWStr = NULL;
+	HANDLE hFile;
+	LARGE_INTEGER fileSize;
+	
+	UINT8 retVal = CPConv_StrConvert(cpcU8_Wide, &fileNameWLen, reinterpret_cast<char**>(&fileNameWStr),
+		fileNameU8.length() + 1, fileNameU8.c_str());	// length()+1 to include the \0
+	if (retVal >= 0x80)
+	{
+		free(fileNameWStr);
+		return false;
+	}
+	hFile = CreateFileW(fileNameWStr, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	free(fileNameWStr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	if (! GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart < 0x20 || fileSize.QuadPart > 0xFFFFFFFF)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+	fMap.size = (UINT32)fileSize.QuadPart;
+	fMap.hMap = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(hFile);	// the mapping keeps the file open
+	if (fMap.hMap == NULL)
+		return false;
+	fMap.data = (const UINT8*)MapViewOfFile(fMap.hMap, FILE_MAP_READ, 0, 0, 0);
+	if (fMap.data == NULL)
+	{
+		CloseHandle(fMap.hMap);
+		return false;
+	}
+#else
+	int hFile;
+	struct stat fileStat;
+	void* mapPtr;
+	
+	hFile = open(fileNameU8.c_str(), O_RDONLY);
+	if (hFile < 0)
+		return false;
+	// pipes, devices etc. can't be mapped
+	if (fstat(hFile, &fileStat) || ! S_ISREG(fileStat.st_mode) ||
+		fileStat.st_size < 0x20 || (UINT64)fileStat.st_size > 0xFFFFFFFF)
+	{
+		close(hFile);
+		return false;
+	}
+	fMap.size = (UINT32)fileStat.st_size;
+	mapPtr = mmap(NULL, fMap.size, PROT_READ, MAP_SHARED, hFile, 0);
+	close(hFile);	// the mapping keeps the file open
+	if (mapPtr == MAP_FAILED)
+		return false;
+	fMap.data = (const UINT8*)mapPtr;
+	posix_madvise(mapPtr, fMap.size, POSIX_MADV_SEQUENTIAL);	// the players read the file from start to end
+#endif
+	return true;
+}
+
+static void UnmapFile(FILE_MAPPING& fMap)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(fMap.data);
+	CloseHandle(fMap.hMap);
+#else
+	munmap((void*)fMap.data, fMap.size);
+#endif
+	fMap.data = NULL;
+	return;
+}
+
+// returns NULL when the file can't be mapped
+static DATA_LOADER* MappedLoader_InitU8(const std::string& fileNameU8)
+{
+	FILE_MAPPING fMap;
+	DATA_LOADER* dLoader;
+	
+	if (! MapFileU8(fileNameU8, fMap))
+		return NULL;
+	dLoader = (DATA_LOADER*)calloc(1, sizeof(DATA_LOADER));
+	if (dLoader == NULL)
+	{
+		UnmapFile(fMap);
+		return NULL;
+	}
+	
+	if (fMap.data[0x00] == 0x1F && fMap.data[0x01] == 0x8B)
+	{
+		// gzip: the trailer ends with the uncompressed size (of the last member, modulo 4 GB)
+		UINT32 size = ReadLE32(&fMap.data[fMap.size - 4]);
+		GZ_LOADER* gzLdr = new GZ_LOADER;
+		gzLdr->map = fMap;
+		gzLdr->sizeKnown = Gz_TrailerIsPlausible(fMap.data, fMap.size, size);
+		if (gzLdr->sizeKnown)
+		{
+			gzLdr->size = size;
+			gzLdr->bufSize = size;
+		}
+		else
+		{
+			// the buffer is enlarged by the thread as needed
+			gzLdr->size = 0;
+			gzLdr->bufSize = (fMap.size < GZ_TRAILER_MAX / 4) ? (fMap.size * 4) : GZ_TRAILER_MAX;
+		}
+		gzLdr->data = (UINT8*)malloc(gzLdr->bufSize ? gzLdr->bufSize : 1);
+		gzLdr->avail = 0;
+		gzLdr->done = false;
+		gzLdr->stop = false;
+		gzLdr->thread = NULL;
+		gzLdr->signal = NULL;
+		gzLdr->pos = 0;
+		if (gzLdr->data == NULL || OSSignal_Init(&gzLdr->signal, 0))
+		{
+			free(gzLdr->data);
+			delete gzLdr;
+			free(dLoader);
+			UnmapFile(fMap);
+			return NULL;
+		}
+		DataLoader_Setup(dLoader, &gzLoader, gzLdr);
+	}
+	else
+	{
+		MMAP_LOADER* mmLdr = new MMAP_LOADER;
+		mmLdr->map = fMap;
+		mmLdr->pos = 0;
+		mmLdr->skipStart = mmLdr->skipEnd = 0;
+		DataLoader_Setup(dLoader, &mmapLoader, mmLdr);
+	}
+	
+	return dLoader;
+}
+
+// Returns the location of the command data of an uncompressed VGM file.
+// The header has the song length, loop and chip information, so only the header and the GD3 tag are needed.
+static bool VGM_GetCommandRange(const FILE_MAPPING& fMap, UINT32& startOfs, UINT32& endOfs)
+{
+	const UINT8* hdr = fMap.data;
+	UINT32 fileVer;
+	
+	if (fMap.size < 0x40 || memcmp(&hdr[0x00], "Vgm ", 4))
+		return false;
+	fileVer = ReadLE32(&hdr[0x08]);
+	if (fileVer < 0x110)
+		return false;	// older files share clocks between chips, leave them to the full parser
+	
+	startOfs = 0x40;
+	if (fileVer >= 0x150 && ReadLE32(&hdr[0x34]))
+		startOfs = 0x34 + ReadLE32(&hdr[0x34]);
+	endOfs = fMap.size;
+	if (ReadLE32(&hdr[0x14]))
+		endOfs = 0x14 + ReadLE32(&hdr[0x14]);	// GD3 tag
+	if (startOfs >= endOfs || endOfs > fMap.size)
+		return false;
+	return (endOfs - startOfs >= 0x10000);	// not worth it for small files
+}
+
+static inline UINT32 ReadLE32(const UINT8* data)
+{
+	return	(data[0x00] <<  0) | (data[0x01] <<  8) |
+			(data[0x02] << 16) | ((UINT32)data[0x03] << 24);
+}
+
+static UINT8 MMapLoader_dopen(void* context)
+{
+	MMAP_LOADER* mmLoader = (MMAP_LOADER*)context;
+	
+	mmLoader->pos = 0;	// the file stays mapped until the loader is destroyed
+	return 0x00;
+}
+
+static UINT32 MMapLoader_dread(void* context, UINT8* buffer, UINT32 numBytes)
+{
+	MMAP_LOADER* mmLoader = (MMAP_LOADER*)context;
+	
+	UINT32 pos = mmLoader->pos;
+	UINT32 endPos;
+	
+	if (numBytes > mmLoader->map.size - pos)
+		numBytes = mmLoader->map.size - pos;
+	endPos = pos + numBytes;
+	if (pos < mmLoader->skipEnd && endPos > mmLoader->skipStart)
+	{
+		UINT32 zeroStart = (pos > mmLoader->skipStart) ? pos : mmLoader->skipStart;
+		UINT32 zeroEnd = (endPos < mmLoader->skipEnd) ? endPos : mmLoader->skipEnd;
+		memcpy(buffer, &mmLoader->map.data[pos], zeroStart - pos);
+		memset(&buffer[zeroStart - pos], 0x00, zeroEnd - zeroStart);
+		memcpy(&buffer[zeroEnd - pos], &mmLoader->map.data[zeroEnd], endPos - zeroEnd);
+	}
+	else
+	{
+		memcpy(buffer, &mmLoader->map.data[pos], numBytes);
+	}
+	mmLoader->pos = endPos;
+	return numBytes;
+}
+
+static UINT8 MMapLoader_dseek(void* context, UINT32 offset, UINT8 whence)
+{
+	MMAP_LOADER* mmLoader = (MMAP_LOADER*)context;
+	
+	if (whence == SEEK_CUR)
+		offset += mmLoader->pos;
+	else if (whence == SEEK_END)
+		offset += mmLoader->map.size;
+	if (offset > mmLoader->map.size)
+		offset = mmLoader->map.size;
+	mmLoader->pos = offset;
+	return 0x00;
+}
+
+static UINT8 MMapLoader_dclose(void* context)
+{
+	return 0x00;
+}
+
+static INT32 MMapLoader_dtell(void* context)
+{
+	MMAP_LOADER* mmLoader = (MMAP_LOADER*)context;
+	
+	return (INT32)mmLoader->pos;
+}
+
+static UINT32 MMapLoader_dlength(void* context)
+{
+	MMAP_LOADER* mmLoader = (MMAP_LOADER*)context;
+	
+	return mmLoader->map.size;
+}
+
+static UINT8 MMapLoader_deof(void* context)
+{
+	MMAP_LOADER* mmLoader = (MMAP_LOADER*)context;
+	
+	return (mmLoader->pos >= mmLoader->map.size);
+}
+
+static UINT8 MMapLoader_ddeinit(void* context)
+{
+	MMAP_LOADER* mmLoader = (MMAP_LOADER*)context;
+	
+	UnmapFile(mmLoader->map);
+	delete mmLoader;
+	return 0x00;
+}
+
+static UINT8 GzLoader_dopen(void* context)
+{
+	GZ_LOADER* gzLoader = (GZ_LOADER*)context;
+	UINT8 retVal;
+	
+	gzLoader->pos = 0;
+	if (gzLoader->thread != NULL)
+		return 0x00;	// reopened, the data inflated so far is kept
+	
+	retVal = OSThread_Init(&gzLoader->thread, GzLoader_InflateThread, gzLoader);
+	if (retVal)
+	{
+		gzLoader->thread = NULL;
+		return 0xFF;
+	}
+	return 0x00;
+}
+
+static UINT32 GzLoader_dread(void* context, UINT8* buffer, UINT32 numBytes)
+{
+	GZ_LOADER* gzLoader = (GZ_LOADER*)context;
+	UINT32 endPos;
+	UINT32 avail;
+	
+	GzLoader_WaitDone(gzLoader);
+	if (numBytes > gzLoader->size - gzLoader->pos)
+		numBytes = gzLoader->size - gzLoader->pos;
+	endPos = gzLoader->pos + numBytes;
+	// wait until the decompression thread is far enough
+	avail = AtomicLoadAcq(&gzLoader->avail);
+	while(avail < endPos && ! AtomicLoadAcq(&gzLoader->done))
+	{
+		OSSignal_Wait(gzLoader->signal);
+		avail = AtomicLoadAcq(&gzLoader->avail);
+	}
+	if (endPos > avail)
+		endPos = avail;	// the file is shorter than the trailer says or broken
+	if (endPos < gzLoader->pos)
+		return 0;
+	
+	numBytes = endPos - gzLoader->pos;
+	memcpy(buffer, &gzLoader->data[gzLoader->pos], numBytes);
+	gzLoader->pos += numBytes;
+	return numBytes;
+}
+
+static UINT8 GzLoader_dseek(void* context, UINT32 offset, UINT8 whence)
+{
+	GZ_LOADER* gzLoader = (GZ_LOADER*)context;
+	
+	GzLoader_WaitDone(gzLoader);
+	if (whence == SEEK_CUR)
+		offset += gzLoader->pos;
+	else if (whence == SEEK_END)
+		offset += gzLoader->size;
+	if (offset > gzLoader->size)
+		offset = gzLoader->size;
+	gzLoader->pos = offset;
+	return 0x00;
+}
+
+static UINT8 GzLoader_dclose(void* context)
+{
+	return 0x00;
+}
+
+static INT32 GzLoader_dtell(void* context)
+{
+	GZ_LOADER* gzLoader = (GZ_LOADER*)context;
+	
+	return (INT32)gzLoader->pos;
+}
+
+static UINT32 GzLoader_dlength(void* context)
+{
+	GZ_LOADER* gzLoader = (GZ_LOADER*)context;
+	
+	GzLoader_WaitDone(gzLoader);
+	return gzLoader->size;
+}
+
+static UINT8 GzLoader_deof(void* context)
+{
+	GZ_LOADER* gzLoader = (GZ_LOADER*)context;
+	
+	GzLoader_WaitDone(gzLoader);
+	return (gzLoader->pos >= gzLoader->size);
+}
+
+static UINT8 GzLoader_ddeinit(void* context)
+{
+	GZ_LOADER* gzLoader = (GZ_LOADER*)context;
+	
+	if (gzLoader->thread != NULL)
+	{
+		AtomicStoreRel(&gzLoader->stop, true);
+		OSThread_Join(gzLoader->thread);
+		OSThread_Deinit(gzLoader->thread);
+	}
+	OSSignal_Deinit(gzLoader->signal);
+	free(gzLoader->data);
+	UnmapFile(gzLoader->map);
+	delete gzLoader;
+	return 0x00;
+}
+
+static void GzLoader_InflateThread(void* args)
+{
+	GZ_LOADER* gzLoader = (GZ_LOADER*)args;
+	z_stream zStrm;
+	UINT32 avail;
+	UINT32 chunkSize;
+	int retVal;
+	
+	memset(&zStrm, 0x00, sizeof(z_stream));
+	retVal = inflateInit2(&zStrm, 16 + MAX_WBITS);	// +16 = expect a gzip header
+	if (retVal != Z_OK)
+	{
+		AtomicStoreRel(&gzLoader->done, true);
+		OSSignal_Signal(gzLoader->signal);
+		return;
+	}
+	
+	zStrm.next_in = (Bytef*)gzLoader->map.data;
+	zStrm.avail_in = gzLoader->map.size;
+	avail = 0;
+	while(! AtomicLoadAcq(&gzLoader->stop))
+	{
+		if (avail == gzLoader->bufSize)
+		{
+			// Only files without a trusted size are inflated until the end of the stream.
+			// Nothing reads from them before the thread is done, so the buffer can be moved.
+			UINT32 newSize = (gzLoader->bufSize < 0x80000000) ? (gzLoader->bufSize * 2) : 0xFFFFFFFF;
+			UINT8* newData;
+			if (gzLoader->sizeKnown || newSize <= gzLoader->bufSize)
+				break;
+			newData = (UINT8*)realloc(gzLoader->data, newSize);
+			if (newData == NULL)
+				break;
+			gzLoader->data = newData;
+			gzLoader->bufSize = newSize;
+		}
+		chunkSize = gzLoader->bufSize - avail;
+		if (chunkSize > GZ_CHUNK_SIZE)
+			chunkSize = GZ_CHUNK_SIZE;
+		zStrm.next_out = &gzLoader->data[avail];
+		zStrm.avail_out = chunkSize;
+		retVal = inflate(&zStrm, Z_NO_FLUSH);
+		avail += chunkSize - zStrm.avail_out;
+		if (gzLoader->sizeKnown)
+		{
+			AtomicStoreRel(&gzLoader->avail, avail);
+			OSSignal_Signal(gzLoader->signal);
+		}
+		if (retVal == Z_STREAM_END && ! gzLoader->sizeKnown &&
+			zStrm.avail_in >= 2 && zStrm.next_in[0] == 0x1F && zStrm.next_in[1] == 0x8B)
+		{
+			inflateReset(&zStrm);	// next member of a multi-member file ("cat a.gz b.gz")
+			continue;
+		}
+		if (retVal != Z_OK)
+			break;	// Z_STREAM_END or an error
+	}
+	if (! gzLoader->sizeKnown)
+	{
+		gzLoader->size = avail;	// published by storing "done"
+		AtomicStoreRel(&gzLoader->avail, avail);
+	}
+	inflateEnd(&zStrm);
+	
+	AtomicStoreRel(&gzLoader->done, true);
+	OSSignal_Signal(gzLoader->signal);
+	return;
+}
+
+// files without a trusted size: the size and the buffer are final only after the thread is done
+static void GzLoader_WaitDone(GZ_LOADER* gzLoader)
+{
+	if (gzLoader->sizeKnown || gzLoader->thread == NULL)
+		return;
+	while(! AtomicLoadAcq(&gzLoader->done))
+		OSSignal_Wait(gzLoader->signal);
+	return;
+}
+
+// The trailer has only the size of the last member, modulo 4 GB. It is used when it fits the compressed data
+// and the file can't have multiple members or more than 4 GB of data.
+static bool Gz_TrailerIsPlausible(const UINT8* gzData, UINT32 gzSize, UINT32 size)
+{
+	UINT32 hdrSize;
+	UINT8 flags;
+	UINT32 curPos;
+	
+	if (size > GZ_TRAILER_MAX)
+		return false;
+	if ((UINT64)gzSize * GZ_MAX_RATIO > 0xFFFFFFFF)
+		return false;	// the size may have wrapped around
+	if ((UINT64)size > (UINT64)gzSize * GZ_MAX_RATIO)
+		return false;
+	
+	// header: 10 bytes + optional extra field, file name, comment and header CRC
+	flags = gzData[0x03];
+	hdrSize = 0x0A;
+	if (flags & 0x04)	// FEXTRA
+		hdrSize += 2 + (gzData[hdrSize + 0] | (gzData[hdrSize + 1] << 8));
+	if (flags & 0x08)	// FNAME
+		while(hdrSize < gzSize && gzData[hdrSize ++] != '\0')
+			;
+	if (flags & 0x10)	// FCOMMENT
+		while(hdrSize < gzSize && gzData[hdrSize ++] != '\0')
+			;
+	if (flags & 0x02)	// FHCRC
+		hdrSize += 2;
+	if ((UINT64)hdrSize + 8 > gzSize)
+		return false;
+	// Deflate data is at most 1/8 larger than the uncompressed data (9-bit literals), otherwise there is
+	// data of more members before the last one.
+	if (gzSize - hdrSize - 8 > (UINT64)size + size / 8 + 0x40)
+		return false;
+	
+	// look for the header of another member
+	for (curPos = hdrSize; curPos + 4 <= gzSize - 8; curPos ++)
+	{
+		const UINT8* hdrPtr = (const UINT8*)memchr(&gzData[curPos], 0x1F, gzSize - 8 - 3 - curPos);
+		if (hdrPtr == NULL)
+			break;
+		curPos = (UINT32)(hdrPtr - gzData);
+		if (hdrPtr[1] == 0x8B && hdrPtr[2] == 0x08 && ! (hdrPtr[3] & 0xE0))
+			return false;
+	}
+	return true;
+}
+
+// Returns a loader that reads the file from the cache, the file is loaded into the cache if needed.
+// Returns NULL when the file can't be cached.
+static DATA_LOADER* AuxCache_GetLoader(const std::string& filePath)
+{
+	AUX_FILE* auxFile;
+	UINT64 mtime;
+	UINT64 fileSize;
+	size_t curFile;
+	
+	if (auxCacheMtx == NULL || ! GetFileStampU8(filePath, mtime, fileSize))
+		return NULL;
+	if (fileSize > auxCacheMax)
+		return NULL;
+	
+	OSMutex_Lock(auxCacheMtx);
+	auxFile = NULL;
+	for (curFile = 0; curFile < auxCache.size(); curFile ++)
+	{
+		if (auxCache[curFile]->path == filePath)
+		{
+			auxFile = auxCache[curFile];
+			break;
+		}
+	}
+	if (auxFile != NULL && (auxFile->mtime != mtime || auxFile->fileSize != fileSize))
+	{
+		// the file was modified
+		auxCache.erase(auxCache.begin() + curFile);
+		auxCacheBytes -= auxFile->data.size();
+		auxFile->cached = false;
+		if (! auxFile->refCnt)
+			delete auxFile;
+		auxFile = NULL;
+	}
+	if (auxFile == NULL)
+	{
+		// Load while holding the lock, so that two players don't load the same file at the same time.
+		DATA_LOADER* fileLoad = GetFileLoaderUTF8(filePath);
+		if (fileLoad == NULL || DataLoader_Load(fileLoad))
+		{
+			if (fileLoad != NULL)
+				DataLoader_Deinit(fileLoad);
+			OSMutex_Unlock(auxCacheMtx);
+			return NULL;
+		}
+		DataLoader_ReadAll(fileLoad);
+		auxFile = new AUX_FILE;
+		auxFile->path = filePath;
+		auxFile->mtime = mtime;
+		auxFile->fileSize = fileSize;
+		auxFile->data.assign(DataLoader_GetData(fileLoad), DataLoader_GetData(fileLoad) + DataLoader_GetSize(fileLoad));
+		auxFile->refCnt = 0;
+		auxFile->cached = true;
+		DataLoader_Deinit(fileLoad);
+		auxCache.push_back(auxFile);
+		auxCacheBytes += auxFile->data.size();
+	}
+	auxFile->refCnt ++;
+	auxFile->lastUse = ++ auxUseCnt;
+	AuxCache_Trim();
+	OSMutex_Unlock(auxCacheMtx);
+	
+	DATA_LOADER* dLoader = (DATA_LOADER*)calloc(1, sizeof(DATA_LOADER));
+	if (dLoader == NULL)
+	{
+		AuxCache_Release(auxFile);
+		return NULL;
+	}
+	AUXREF_LOADER* arLoader = new AUXREF_LOADER;
+	arLoader->file = auxFile;
+	arLoader->pos = 0;
+	DataLoader_Setup(dLoader, &auxLoader, arLoader);
+	return dLoader;
+}
+
+static void AuxCache_Release(AUX_FILE* auxFile)
+{
+	OSMutex_Lock(auxCacheMtx);
+	auxFile->refCnt --;
+	if (! auxFile->cached && ! auxFile->refCnt)
+		delete auxFile;
+	else
+		AuxCache_Trim();
+	OSMutex_Unlock(auxCacheMtx);
+	return;
+}
+
+// must be called with auxCacheMtx locked
+// Removes the least recently used files that no player reads from until the cache fits into its limit.
+static void AuxCache_Trim(void)
+{
+	while(auxCacheBytes > auxCacheMax)
+	{
+		size_t oldIdx = (size_t)-1;
+		size_t curFile;
+		for (curFile = 0; curFile < auxCache.size(); curFile ++)
+		{
+			const AUX_FILE* auxFile = auxCache[curFile];
+			if (auxFile->refCnt)
+				continue;
+			if (oldIdx == (size_t)-1 || (INT32)(auxFile->lastUse - auxCache[oldIdx]->lastUse) < 0)
+				oldIdx = curFile;
+		}
+		if (oldIdx == (size_t)-1)
+			break;	// all files are in use
+		
+		AUX_FILE* auxFile = auxCache[oldIdx];
+		auxCache.erase(auxCache.begin() + oldIdx);
+		auxCacheBytes -= auxFile->data.size();
+		delete auxFile;
+	}
+	return;
+}
+
+// Archive members are decompressed into memory and read through an AUX_FILE that isn't part of the cache.
+static DATA_LOADER* ZipLoader_InitU8(const std::string& zipPath, const std::string& memberName)
+{
+	AUX_FILE* auxFile = new AUX_FILE;
+	if (ZipArchive_ReadMember(zipPath, memberName, auxFile->data) || GunzipData(auxFile->data))
+	{
+		delete auxFile;
+		return NULL;
+	}
+	auxFile->path = zipPath + "/" + memberName;
+	auxFile->mtime = 0;
+	auxFile->fileSize = auxFile->data.size();
+	auxFile->refCnt = 1;
+	auxFile->lastUse = 0;
+	auxFile->cached = false;	// deleted by the loader
+	
+	DATA_LOADER* dLoader = (DATA_LOADER*)calloc(1, sizeof(DATA_LOADER));
+	if (dLoader == NULL)
+	{
+		delete auxFile;
+		return NULL;
+	}
+	AUXREF_LOADER* arLoader = new AUXREF_LOADER;
+	arLoader->file = auxFile;
+	arLoader->pos = 0;
+	DataLoader_Setup(dLoader, &auxLoader, arLoader);
+	return dLoader;
+}
+
+// decompresses gzip data (.vgz files) in place, other data is left as it is
+static UINT8 GunzipData(std::vector<UINT8>& data)
+{
+	z_stream zStrm;
+	std::vector<UINT8> outData;
+	size_t dataLen;
+	int retVal;
+	
+	if (data.size() < 0x12 || data[0x00] != 0x1F || data[0x01] != 0x8B)
+		return 0x00;	// not compressed
+	
+	// the trailer contains the decompressed size (modulo 4 GB), it is used when it is plausible
+	dataLen = ReadLE32(&data[data.size() - 4]);
+	if (data.size() > 0xFFFFFFFF || ! Gz_TrailerIsPlausible(&data[0], (UINT32)data.size(), (UINT32)dataLen))
+		dataLen = 0;
+	outData.resize(dataLen ? dataLen : 0x10000);
+	memset(&zStrm, 0x00, sizeof(z_stream));
+	if (inflateInit2(&zStrm, 16 + MAX_WBITS) != Z_OK)	// +16 = expect a gzip header
+		return 0xC0;
+	zStrm.next_in = &data[0];
+	zStrm.avail_in = (uInt)data.size();
+	zStrm.next_out = &outData[0];
+	zStrm.avail_out = (uInt)outData.size();
+	while((retVal = inflate(&zStrm, Z_NO_FLUSH)) == Z_OK)
+	{
+		if (zStrm.avail_out > 0)
+			continue;
+		// larger than the trailer says or the trailer isn't used
+		size_t oldSize = outData.size();
+		if (oldSize >= 0x80000000)
+			break;	// uInt can't hold the size anymore
+		outData.resize(oldSize * 2);
+		zStrm.next_out = &outData[oldSize];
+		zStrm.avail_out = (uInt)(outData.size() - oldSize);
+	}
+	inflateEnd(&zStrm);
+	if (retVal != Z_STREAM_END)
+		return 0xC1;
+	outData.resize(zStrm.total_out);
+	data.swap(outData);
+	return 0x00;
+}
+
+static UINT8 AuxLoader_dopen(void* context)
+{
+	AUXREF_LOADER* arLoader = (AUXREF_LOADER*)context;
+	
+	arLoader->pos = 0;
+	return 0x00;
+}
+
+static UINT32 AuxLoader_dread(void* context, UINT8* buffer, UINT32 numBytes)
+{
+	AUXREF_LOADER* arLoader = (AUXREF_LOADER*)context;
+	const std::vector<UINT8>& data = arLoader->file->data;
+	
+	if (numBytes > data.size() - arLoader->pos)
+		numBytes = (UINT32)data.size() - arLoader->pos;
+	if (numBytes > 0)
+		memcpy(buffer, &data[arLoader->pos], numBytes);
+	arLoader->pos += numBytes;
+	return numBytes;
+}
+
+static UINT8 AuxLoader_dseek(void* context, UINT32 offset, UINT8 whence)
+{
+	AUXREF_LOADER* arLoader = (AUXREF_LOADER*)context;
+	UINT32 size = (UINT32)arLoader->file->data.size();
+	
+	if (whence == SEEK_CUR)
+		offset += arLoader->pos;
+	else if (whence == SEEK_END)
+		offset += size;
+	if (offset > size)
+		offset = size;
+	arLoader->pos = offset;
+	return 0x00;
+}
+
+static UINT8 AuxLoader_dclose(void* context)
+{
+	return 0x00;
+}
+
+static INT32 AuxLoader_dtell(void* context)
+{
+	AUXREF_LOADER* arLoader = (AUXREF_LOADER*)context;
+	
+	return (INT32)arLoader->pos;
+}
+
+static UINT32 AuxLoader_dlength(void* context)
+{
+	AUXREF_LOADER* arLoader = (AUXREF_LOADER*)context;
+	
+	return (UINT32)arLoader->file->data.size();
+}
+
+static UINT8 AuxLoader_deof(void* context)
+{
+	AUXREF_LOADER* arLoader = (AUXREF_LOADER*)context;
+	
+	return (arLoader->pos >= arLoader->file->data.size());
+}
+
+static UINT8 AuxLoader_ddeinit(void* context)
+{
+	AUXREF_LOADER* arLoader = (AUXREF_LOADER*)context;
+	
+	AuxCache_Release(arLoader->file);
+	delete arLoader;
+	return 0x00;
+}
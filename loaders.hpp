@@ -0,0 +1,23 @@
+#ifndef __LOADERS_HPP__
+#define __LOADERS_HPP__
+
+#include <stdtype.h>
+#include <string>
+#include <utils/DataLoader.h>
+
+class PlayerBase;
+
+UINT8 Loaders_Init(void);
+void Loaders_Deinit(void);
+// memory limit for the cache of files that are requested by the players
+void Loaders_SetAuxCacheSize(UINT64 maxBytes);
+// Get up to maxBytes of the file into the OS file cache. Returns the number of bytes requested.
+// cancel: checked while reading, when the system has no read-ahead hint
+UINT64 Loaders_PrefetchFile(const std::string& fileNameU8, UINT64 maxBytes, const volatile bool* cancel);
+DATA_LOADER* GetFileLoaderUTF8(const std::string& fileNameU8);
+// for reading the song information only: the command data of VGM files isn't loaded and reads as zeros
+DATA_LOADER* GetSongInfoLoaderUTF8(const std::string& fileNameU8);
+// PlayerA file request callback, searches files in the application search paths
+DATA_LOADER* PlayerFileReqCallback(void* userParam, PlayerBase* player, const char* fileName);
+
+#endif	// __LOADERS_HPP__
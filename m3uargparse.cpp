@@ -3,6 +3,8 @@
 #include <vector>
 #include <fstream>
 #include <istream>
+#include <sstream>
+#include <algorithm>
 #ifdef _WIN32
 #include <Windows.h>	// for file name charset conversion
 #include <wchar.h>	// for UTF-16 file name functions
@@ -11,6 +13,7 @@
 
 #include "stdtype.h"
 #include "utils.hpp"
+#include "ziparchive.hpp"
 #include "m3uargparse.hpp"
 
 
@@ -23,12 +26,16 @@
 static const char* M3UV2_HEAD = "#EXTM3U";
 static const char* M3UV2_META = "#EXTINF:";
 static const UINT8 UTF8_SIG[] = {0xEF, 0xBB, 0xBF};
+// files in archives that are added as songs
+static const char* const ZIP_SONG_EXTS[] = {"vgm", "vgz", "s98", "dro", NULL};
 
 
 //UINT8 ParseSongFiles(const std::vector<char*>& args, std::vector<SongFileList>& songList, std::vector<PlaylistFileList>& playlistList);
 //UINT8 ParseSongFiles(const std::vector<const char*>& args, std::vector<SongFileList>& songList, std::vector<PlaylistFileList>& playlistList);
 //UINT8 ParseSongFiles(const std::vector<std::string>& args, std::vector<SongFileList>& songList, std::vector<PlaylistFileList>& playlistList);
 //UINT8 ParseSongFiles(size_t argc, const char* const* argv, std::vector<SongFileList>& songList, std::vector<PlaylistFileList>& playlistList);
+static bool AddM3UPlaylist(const char* fileName, bool isM3Uu8, std::vector<SongFileList>& songList, std::vector<PlaylistFileList>& playlistList);
+static bool AddZipArchive(const char* fileName, std::vector<SongFileList>& songList, std::vector<PlaylistFileList>& playlistList);
 static bool ReadM3UPlaylist(const char* fileName, std::vector<SongFileList>& songList, bool isM3Uu8);
 
 
@@ -74,21 +81,15 @@ UINT8 ParseSongFiles(size_t argc, const char* const* argv, std::vector<SongFileL
 			fileExt = "";
 		if (! stricmp(fileExt, "m3u") || ! stricmp(fileExt, "m3u8"))
 		{
-			size_t plSong = songList.size();
-			
-			retValB = ReadM3UPlaylist(fileName, songList, ! stricmp(fileExt, "m3u8"));
+			retValB = AddM3UPlaylist(fileName, ! stricmp(fileExt, "m3u8"), songList, playlistList);
+			if (! retValB)
+				resVal |= 0x01;
+		}
+		else if (! stricmp(fileExt, "zip"))
+		{
+			retValB = AddZipArchive(fileName, songList, playlistList);
 			if (! retValB)
-			{
 				resVal |= 0x01;
-				continue;
-			}
-			
-			PlaylistFileList pfl;
-			pfl.fileName = fileName;
-			pfl.songCount = songList.size() - plSong;
-			for (; plSong < songList.size(); plSong ++)
-				songList[plSong].playlistID = playlistList.size();
-			playlistList.push_back(pfl);
 		}
 		else
 		{
@@ -103,9 +104,77 @@ UINT8 ParseSongFiles(size_t argc, const char* const* argv, std::vector<SongFileL
 	return 0x00;
 }
 
+static bool AddM3UPlaylist(const char* fileName, bool isM3Uu8, std::vector<SongFileList>& songList, std::vector<PlaylistFileList>& playlistList)
+{
+	size_t plSong = songList.size();
+	
+	if (! ReadM3UPlaylist(fileName, songList, isM3Uu8))
+		return false;
+	
+	PlaylistFileList pfl;
+	pfl.fileName = fileName;
+	pfl.songCount = songList.size() - plSong;
+	for (; plSong < songList.size(); plSong ++)
+		songList[plSong].playlistID = playlistList.size();
+	playlistList.push_back(pfl);
+	return true;
+}
+
+// Archives with playlists are played using their playlists, else all songs in the archive are played by name.
+static bool AddZipArchive(const char* fileName, std::vector<SongFileList>& songList, std::vector<PlaylistFileList>& playlistList)
+{
+	std::vector<std::string> members;
+	std::vector<std::string> songFiles;
+	size_t plCount;
+	size_t curFile;
+	
+	if (ZipArchive_ListMembers(fileName, members))
+		return false;
+	std::sort(members.begin(), members.end());
+	
+	plCount = 0;
+	for (curFile = 0; curFile < members.size(); curFile ++)
+	{
+		std::string memberPath = std::string(fileName) + "/" + members[curFile];
+		const char* fileExt = GetFileExtension(members[curFile].c_str());
+		if (fileExt == NULL)
+			continue;
+		if (! stricmp(fileExt, "m3u") || ! stricmp(fileExt, "m3u8"))
+		{
+			if (AddM3UPlaylist(memberPath.c_str(), ! stricmp(fileExt, "m3u8"), songList, playlistList))
+				plCount ++;
+			continue;
+		}
+		for (const char* const* songExt = ZIP_SONG_EXTS; *songExt != NULL; songExt ++)
+		{
+			if (! stricmp(fileExt, *songExt))
+			{
+				songFiles.push_back(memberPath);
+				break;
+			}
+		}
+	}
+	if (plCount > 0)
+		return true;
+	
+	for (curFile = 0; curFile < songFiles.size(); curFile ++)
+	{
+		SongFileList sfl;
+		sfl.fileName = songFiles[curFile];
+		sfl.playlistID = (size_t)-1;
+		sfl.playlistSongID = (size_t)-1;
+		songList.push_back(sfl);
+	}
+	return true;
+}
+
 static bool ReadM3UPlaylist(const char* fileName, std::vector<SongFileList>& songList, bool isM3Uu8)
 {
 	std::ifstream hFile;
+	std::istringstream memFile;	// for playlists inside archives
+	std::istream* plFile;
+	std::string zipPath;
+	std::string memberName;
 	std::string baseDir;
 	char fileSig[0x03];
 	bool isUTF8;
@@ -116,25 +185,39 @@ static bool ReadM3UPlaylist(const char* fileName, std::vector<SongFileList>& son
 	size_t songID;
 	CPCONV* cpcU8;
 	
+	if (ZipPath_Split(fileName, zipPath, memberName) && ! memberName.empty() &&
+		ZipArchive_HasMember(zipPath, memberName))
+	{
+		std::vector<UINT8> plData;
+		if (ZipArchive_ReadMember(zipPath, memberName, plData))
+			return false;
+		memFile.str(std::string(plData.begin(), plData.end()));
+		plFile = &memFile;
+	}
+	else
+	{
 #if defined(_WIN32) && ! defined(_MSC_VER) || _MSC_VER >= 1400
-	// not using libvgm CPConv here, because using WinAPIs doesn't need separate initialization
-	std::wstring fileNameW;
-	fileNameW.resize(MultiByteToWideChar(CP_UTF8, 0, fileName, -1, NULL, 0) - 1);
-	MultiByteToWideChar(CP_UTF8, 0, fileName, -1, &fileNameW[0], fileNameW.size());
-	hFile.open(fileNameW);
+		// not using libvgm CPConv here, because using WinAPIs doesn't need separate initialization
+		std::wstring fileNameW;
+		fileNameW.resize(MultiByteToWideChar(CP_UTF8, 0, fileName, -1, NULL, 0) - 1);
+		MultiByteToWideChar(CP_UTF8, 0, fileName, -1, &fileNameW[0], fileNameW.size());
+		hFile.open(fileNameW);
 #else
-	hFile.open(fileName);
+		hFile.open(fileName);
 #endif
-	if (! hFile.is_open())
-		return false;
+		if (! hFile.is_open())
+			return false;
+		plFile = &hFile;
+	}
 	
+	// for playlists in archives, this is "pack.zip/", so that the songs are taken from the archive
 	baseDir = std::string(fileName, GetFileTitle(fileName) - fileName);
 	
 	memset(fileSig, 0x00, 3);
-	hFile.read(fileSig, 3);
+	plFile->read(fileSig, 3);
 	isUTF8 = ! memcmp(fileSig, UTF8_SIG, 3);	// check for UTF-8 BOM
 	if (! isUTF8)
-		hFile.seekg(0, std::ios_base::beg);
+		plFile->seekg(0, std::ios_base::beg);
 	isUTF8 |= isM3Uu8;
 	
 	cpcU8 = NULL;
@@ -145,9 +228,9 @@ static bool ReadM3UPlaylist(const char* fileName, std::vector<SongFileList>& son
 	METASTR_LEN = strlen(M3UV2_META);
 	lineNo = 0;
 	songID = 0;
-	while(hFile.good() && ! hFile.eof())
+	while(plFile->good() && ! plFile->eof())
 	{
-		std::getline(hFile, tempStr);
+		std::getline(*plFile, tempStr);
 		lineNo ++;
 		
 		while(! tempStr.empty() && iscntrl((unsigned char)tempStr[tempStr.size() - 1]))
@@ -192,7 +275,8 @@ static bool ReadM3UPlaylist(const char* fileName, std::vector<SongFileList>& son
 	if (cpcU8 != NULL)
 		CPConv_Deinit(cpcU8);
 	
-	hFile.close();
+	if (hFile.is_open())
+		hFile.close();
 	
 	return true;
 }
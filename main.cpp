@@ -26,6 +26,8 @@
 #ifdef _WIN32
 #include <conio.h>
 #include <Windows.h>
+#include <io.h>		// for _dup() etc.
+#include <fcntl.h>	// for _O_BINARY
 
 #define USE_WMAIN
 #else
@@ -36,19 +38,17 @@
 #define MAX_PATH	PATH_MAX
 #endif
 
-#include <ini.h>
 #include <getopt.h>
 
 #include "stdtype.h"
 #include "utils.hpp"
 #include "m3uargparse.hpp"
 #include "config.hpp"
+#include "appcfg.hpp"
+#include "batchrender.hpp"
+#include "songscan.hpp"
 #include "version.h"
 
-#ifndef SHARE_PREFIX
-#define SHARE_PREFIX	"/usr"
-#endif
-
 
 // from playctrl.cpp
 extern UINT8 PlayerMain(UINT8 showFileName);
@@ -65,12 +65,9 @@ struct OptionItem
 typedef std::vector<OptionItem> OptionList;
 
 
-static char* GetAppFilePath(void);
-static void InitAppSearchPaths(const char* argv_0);
 static std::string ReadLineAsUTF8(void);
+static FILE* DetachStdout(void);
 
-static int IniValHandler(void* user, const char* section, const char* name, const char* value);
-static UINT8 LoadConfig(const std::string& iniPath, Configuration& cfg);
 static std::string GenerateOptData(const OptionList& optList, std::vector<struct option>* longOpts);
 static void PrintVersion(void);
 static void PrintArgumentHelp(const OptionList& optList);
@@ -85,6 +82,11 @@ static const OptionItem OPT_LIST_ARR[] =
 	{0, 'w', "dump-wav",        NULL,     "enable WAV dumping"},
 	{1, 'd', "output-device",   "id",     "output device ID"},
 	{1, 'c', "config",          "option", "set configuration option, format: section.key=Data"},
+	{1, 'o', "render-out",      "dir",    "render all songs to WAV files in <dir> as fast as possible, without playback"},
+	{1, 'j', "jobs",            "n",      "number of songs to render or scan in parallel (default: number of CPU cores)"},
+	{0, 's', "stems",           NULL,     "render one WAV file per sound chip (with --render-out)"},
+	{1, 'p', "pipe",            "format", "render all songs to stdout as fast as it is read, format: raw (PCM) or wav"},
+	{0, 'i', "scan",            NULL,     "print length, loop, chips and tags of all songs to stdout (one JSON object per line)"},
 };
 static const size_t OPT_LIST_SIZE = sizeof(OPT_LIST_ARR) / sizeof(OPT_LIST_ARR[0]);
 
@@ -92,6 +94,9 @@ static const size_t OPT_LIST_SIZE = sizeof(OPT_LIST_ARR) / sizeof(OPT_LIST_ARR[0
        std::vector<std::string> appSearchPaths;
 static std::vector<std::string> cfgFileNames;
        Configuration playerCfg;
+static std::string renderOutDir;	// batch rendering mode when not empty
+static std::string pipeFormat;		// streaming to stdout when not empty
+static bool scanMode = false;		// print song information to stdout
 
        std::vector<SongFileList> songList;
        std::vector<PlaylistFileList> plList;
@@ -125,14 +130,43 @@ int main(int argc, char* argv[])
 	// Note: I'm not freeing argv anywhere. I'll let Windows take care about it this one time.
 #endif
 	
-	printf(APP_NAME);
-	printf("\n----------\n");
-	
 	argbase = ParseArguments(argc, argv, optionList, argCfg);
 	if (argbase == 0)
 		return 0;
 	else if (argbase < 0)
 		return 1;
+	FILE* pipeFile = NULL;
+	if (scanMode && ! pipeFormat.empty())
+	{
+		fprintf(stderr, "--scan and --pipe can't be used together!\n");
+		return 1;
+	}
+	if (scanMode)
+	{
+		pipeFile = DetachStdout();	// the records go to stdout, all messages to stderr
+		if (pipeFile == NULL)
+		{
+			fprintf(stderr, "Unable to use stdout for the scan results!\n");
+			return 1;
+		}
+	}
+	if (! pipeFormat.empty())
+	{
+		if (pipeFormat != "raw" && pipeFormat != "wav")
+		{
+			fprintf(stderr, "Invalid stream format: %s (must be \"raw\" or \"wav\")\n", pipeFormat.c_str());
+			return 1;
+		}
+		pipeFile = DetachStdout();	// from now on, all messages go to stderr
+		if (pipeFile == NULL)
+		{
+			fprintf(stderr, "Unable to use stdout for the audio stream!\n");
+			return 1;
+		}
+	}
+	
+	printf(APP_NAME);
+	printf("\n----------\n");
 #if 0
 	if (argc < argbase + 1)
 	{
@@ -143,7 +177,7 @@ int main(int argc, char* argv[])
 	}
 #endif
 	
-	InitAppSearchPaths(argv[0]);
+	InitAppSearchPaths(argv[0], appSearchPaths);
 	cfgFileNames.push_back("VGMPlay.ini");
 	cfgFileNames.push_back("vgmplay.ini");
 	
@@ -195,99 +229,25 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 	printf("\n");
-	retVal = PlayerMain(fnEnterMode);
-	printf("Bye.\n");
-	
-	return 0;
-}
-
-static char* GetAppFilePath(void)
-{
-	char* appPath;
-	int retVal;
-	
-#ifdef _WIN32
-#ifdef USE_WMAIN
-	std::vector<wchar_t> appPathW;
-	
-	appPathW.resize(MAX_PATH);
-	retVal = GetModuleFileNameW(NULL, &appPathW[0], appPathW.size());
-	if (! retVal)
-		appPathW[0] = L'\0';
-	
-	retVal = WideCharToMultiByte(CP_UTF8, 0, &appPathW[0], -1, NULL, 0, NULL, NULL);
-	if (retVal < 0)
-		retVal = 1;
-	appPath = (char*)malloc(retVal);
-	retVal = WideCharToMultiByte(CP_UTF8, 0, &appPathW[0], -1, appPath, retVal, NULL, NULL);
-	if (retVal < 0)
-		appPath[0] = '\0';
-	appPathW.clear();
-#else
-	appPath = (char*)malloc(MAX_PATH * sizeof(char));
-	retVal = GetModuleFileNameA(NULL, appPath, MAX_PATH);
-	if (! retVal)
-		appPath[0] = '\0';
-#endif
-#else
-	appPath = (char*)malloc(PATH_MAX * sizeof(char));
-	retVal = readlink("/proc/self/exe", appPath, PATH_MAX);
-	if (retVal == -1)
-		appPath[0] = '\0';
-#endif
-	
-	return appPath;
-}
-
-static void InitAppSearchPaths(const char* argv_0)
-{
-	appSearchPaths.clear();
-	
-#ifndef _WIN32
-	// 1. [Unix only] global share directory
-	appSearchPaths.push_back(SHARE_PREFIX "/share/vgmplay/");
-#endif
-	
-	// 2. actual application path (potentially resolved symlink)
-	char* appPath = GetAppFilePath();
-	const char* appTitle = GetFileTitle(appPath);
-	if (appTitle != appPath)
-		appSearchPaths.push_back(std::string(appPath, appTitle - appPath));
-	free(appPath);
-	
-	// 3. called path
-	appTitle = GetFileTitle(argv_0);
-	if (appTitle != argv_0)
+	if (scanMode)
 	{
-		std::string callPath(argv_0, appTitle - argv_0);
-		if (callPath != appSearchPaths[appSearchPaths.size() - 1])
-			appSearchPaths.push_back(callPath);
+		retVal = ScanMain(pipeFile);
+		return retVal ? 1 : 0;
 	}
-	
-	// 4. home/config directory
-	std::string cfgDir;
-#ifdef _WIN32
-	cfgDir = getenv("USERPROFILE");
-	cfgDir += "/.vgmplay/";
-#else
-	char* xdgPath = getenv("XDG_CONFIG_HOME");
-	if (xdgPath != NULL && xdgPath[0] != '\0')
+	if (pipeFile != NULL)
 	{
-		cfgDir = xdgPath;
+		retVal = StreamRenderMain(pipeFile, pipeFormat == "raw");
+		return retVal ? 1 : 0;
 	}
-	else
+	if (! renderOutDir.empty())
 	{
-		cfgDir = getenv("HOME");
-		cfgDir += "/.config";
+		retVal = BatchRenderMain(renderOutDir);
+		return retVal ? 1 : 0;
 	}
-	cfgDir += "/vgmplay/";
-#endif
-	appSearchPaths.push_back(cfgDir);
-	
-	// 5. working directory
-	appSearchPaths.push_back("./");
+	retVal = PlayerMain(fnEnterMode);
+	printf("Bye.\n");
 	
-	return;
+	return 0;
 }
 
 static std::string ReadLineAsUTF8(void)
@@ -341,38 +301,30 @@ static std::string ReadLineAsUTF8(void)
 	return fileName;
 }
 
-
-static int IniValHandler(void* user, const char* section, const char* name, const char* value)
+// Moves the original stdout to a new FILE handle and redirects the standard output to stderr,
+// so that everything that is printed can't end up in the audio stream.
+static FILE* DetachStdout(void)
 {
-	Configuration* cfg = (Configuration*)user;
-	
-	bool ordered = false;
-	if (! strnicmp(name, "Mute", 4))
-		ordered = true;
-	else if (! strnicmp(name, "Pan", 3))
-		ordered = true;
-	
-	cfg->AddEntry(section, name, value, ordered);
+	int pcmFD;
 	
-	return 1;
+	fflush(stdout);
+#ifdef _WIN32
+	pcmFD = _dup(_fileno(stdout));
+	if (pcmFD < 0)
+		return NULL;
+	_dup2(_fileno(stderr), _fileno(stdout));
+	SetStdHandle(STD_OUTPUT_HANDLE, GetStdHandle(STD_ERROR_HANDLE));	// for u8printf()
+	_setmode(pcmFD, _O_BINARY);
+	return _fdopen(pcmFD, "wb");
+#else
+	pcmFD = dup(STDOUT_FILENO);
+	if (pcmFD < 0)
+		return NULL;
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+	return fdopen(pcmFD, "wb");
+#endif
 }
 
-static UINT8 LoadConfig(const std::string& iniPath, Configuration& cfg)
-{
-	int retVal;
-	
-	retVal = ini_parse(iniPath.c_str(), IniValHandler, &cfg);
-	if (retVal == -2)
-		return 0xF8;	// malloc error
-	else if (retVal == -1)
-		return 0xF0;	// file not found
-	else if (retVal < 0)
-		return 0xFF;	// unknown error
-	else if (retVal > 0)
-		return 0x01;	// parse error
-	else
-		return 0x00;
-}
 
 static std::string GenerateOptData(const OptionList& optList, std::vector<struct option>* longOpts)
 {
@@ -486,21 +438,23 @@ static int ParseArguments(int argc, char* argv[], const OptionList& optList, Con
 		case 'd':	// output-device
 			argCfg.AddEntry("General", "OutputDevice", optarg);
 			break;
+		case 'o':	// render-out
+			renderOutDir = optarg;
+			break;
+		case 'j':	// jobs
+			argCfg.AddEntry("General", "RenderThreads", optarg);
+			break;
+		case 's':	// stems
+			argCfg.AddEntry("General", "RenderStems", "1");
+			break;
+		case 'p':	// pipe
+			pipeFormat = optarg;
+			break;
+		case 'i':	// scan
+			scanMode = true;
+			break;
 		case 'c':	// configuration setting
-			{
-				std::string optstr = optarg;
-				char* sect = &optstr[0];
-				char* key = strchr(sect, '.');
-				if (key == NULL)
-					break;
-				*key = '\0';	key ++;
-				char* val = strchr(key, '=');
-				if (val == NULL)
-					break;
-				*val = '\0';	val ++;
-				// reuse INI handler, so that the MuteMask values are put into the correct section
-				IniValHandler(&argCfg, sect, key, val);
-			}
+			AddConfigOption(argCfg, optarg);
 			break;
 		}
 	}
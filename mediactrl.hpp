@@ -10,6 +10,7 @@ public:
 	UINT8 Init(MediaInfo& mediaInfo);
 	void Deinit(void);
 	void ReadWriteDispatch(void);
+	int GetWaitFD(void);	// file descriptor that becomes readable on incoming requests (-1 = none)
 private:
 	static void SignalCB(MediaInfo* mInfo, void* userParam, UINT8 signalMask);
 	void SignalHandler(UINT8 signalMask);
@@ -104,6 +104,11 @@ void MediaControl::ReadWriteDispatch(void)
 	return;
 }
 
+int MediaControl::GetWaitFD(void)
+{
+	return -1;	// media key events are sent from a separate thread
+}
+
 /*static*/ void MediaControl::SignalCB(MediaInfo* mInfo, void* userParam, UINT8 signalMask)
 {
 	MediaControl* obj = static_cast<MediaControl*>(userParam);
@@ -979,8 +979,20 @@ void MediaControl::ReadWriteDispatch(void)
 	if(connection == NULL)
 		return;
 
-	// Wait at most for 1ms
-	dbus_connection_read_write_dispatch(connection, 1);
+	// don't wait - the main loop polls the connection's file descriptor
+	dbus_connection_read_write(connection, 0);
+	while(dbus_connection_dispatch(connection) == DBUS_DISPATCH_DATA_REMAINS)
+		;
+}
+
+int MediaControl::GetWaitFD(void)
+{
+	int fd = -1;
+	if(connection == NULL)
+		return -1;
+	if(!dbus_connection_get_unix_fd(connection, &fd))
+		return -1;
+	return fd;
 }
 
 /*static*/ void MediaControl::SignalCB(MediaInfo* mInfo, void* userParam, UINT8 signalMask)
@@ -1002,5 +1014,8 @@ void MediaControl::SignalHandler(UINT8 signalMask)
 	if (signalMask & MI_SIG_VOLUME)
 		dbusSignal |= SIGNAL_CONTROLS;
 	DBus_EmitSignal(dbusSignal);
+	// send now, the main loop may not wake up again for a while when paused
+	if(connection != NULL)
+		dbus_connection_flush(connection);
 	return;
 }
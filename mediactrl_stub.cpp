@@ -16,6 +16,11 @@ void MediaControl::ReadWriteDispatch(void)
 	return;
 }
 
+int MediaControl::GetWaitFD(void)
+{
+	return -1;
+}
+
 /*static*/ void MediaControl::SignalCB(MediaInfo* mInfo, void* userParam, UINT8 signalMask)
 {
 	MediaControl* obj = static_cast<MediaControl*>(userParam);
@@ -314,10 +314,19 @@ void MediaInfo::AddSignalCallback(MI_SIGNAL_CB func, void* param)
 	return;
 }
 
+void MediaInfo::SetEventCallback(MI_EVENT_CB func, void* param)
+{
+	_evtCbFunc = func;
+	_evtCbParam = param;
+	return;
+}
+
 void MediaInfo::Event(UINT8 evtType, INT32 evtParam)
 {
 	EventData ed = {evtType, evtParam};
 	_evtQueue.push(ed);
+	if (_evtCbFunc != NULL)
+		_evtCbFunc(this, _evtCbParam);
 	return;
 }
 
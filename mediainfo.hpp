@@ -34,10 +34,13 @@
 
 class MediaInfo;
 typedef void (*MI_SIGNAL_CB)(MediaInfo* mInfo, void* userParam, UINT8 signalMask);
+typedef void (*MI_EVENT_CB)(MediaInfo* mInfo, void* userParam);
 
 class MediaInfo
 {
 public:
+	MediaInfo() : _evtCbFunc(NULL), _evtCbParam(NULL)	{}
+	
 	void PreparePlayback(void);
 	const char* GetSongTagForDisp(const std::string& tagName);
 	void EnumerateTags(void);	// implicitly called by PreparePlayback(), as that one may parse some of the tags
@@ -45,6 +48,7 @@ public:
 	void SearchAlbumImage(void);
 	
 	void AddSignalCallback(MI_SIGNAL_CB func, void* param);
+	void SetEventCallback(MI_EVENT_CB func, void* param);	// called after queueing an event, may run on any thread
 	void Event(UINT8 evtType, INT32 evtParam);
 	void Signal(UINT8 signalMask);
 	
@@ -92,6 +96,8 @@ public:
 	
 	std::vector<SignalHandler> _sigCb;
 	std::queue<EventData> _evtQueue;
+	MI_EVENT_CB _evtCbFunc;
+	void* _evtCbParam;
 	bool _enableAlbumImage;
 };
 
@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <direct.h>		// for _mkdir()
+#include <io.h>			// for _findfirst()
+#include <sys/utime.h>
+#else
+#include <sys/stat.h>	// for mkdir(), stat()
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+#include <zlib.h>
+
+#include <stdtype.h>
+
+#include "utils.hpp"
+#include "pcmcache.hpp"
+#include "playcfg.hpp"
+
+
+/*
+Cache file format (all values Little Endian)
+	00  4  signature "VPCM"
+	04  1  version
+	05  1  bytes per sample
+	06  1  filter: 0 - none, 1 - delta 16-bit stereo, 2 - delta 32-bit stereo
+	07  1  reserved
+	08  8  key
+	10  4  size of the uncompressed data
+	14  4  size of the compressed data
+	18  -  zlib stream
+*/
+#define CACHE_HDR_SIZE	0x18
+#define CACHE_VERSION	0x01
+#define CACHE_FILE_EXT	".vpcm"
+#define COMP_CHUNK_SIZE	0x40000	// 256 KB
+
+#define FILTER_NONE		0x00
+#define FILTER_DELTA16	0x01
+#define FILTER_DELTA32	0x02
+
+struct CacheFileInfo
+{
+	std::string path;
+	time_t mtime;
+	UINT64 size;
+};
+
+static UINT8 GetFilter(UINT32 smplSize);
+static void ApplyDeltaFilter(UINT8 filter, UINT8* data, size_t size);
+static void RemoveDeltaFilter(UINT8 filter, std::vector<UINT8>& data);
+static bool ListCacheFiles(const std::string& dirPath, std::vector<CacheFileInfo>& files);
+static bool CompareMTime(const CacheFileInfo& a, const CacheFileInfo& b);
+static inline UINT32 ReadLE32(const UINT8* buffer);
+static inline void WriteLE32(UINT8* buffer, UINT32 value);
+
+PCMCache::PCMCache() :
+	_maxSize(0)
+{
+}
+
+UINT8 PCMCache::SetDirectory(const std::string& dirPath, UINT64 maxSize)
+{
+	int retVal;
+	
+	_dirPath = std::string();
+	_maxSize = maxSize;
+	if (dirPath.empty())
+		return 0x00;
+	
+#ifdef _WIN32
+	retVal = _mkdir(dirPath.c_str());
+#else
+	retVal = mkdir(dirPath.c_str(), 0777);
+#endif
+	if (retVal && errno != EEXIST)
+		return 0xFF;
+	
+	_dirPath = dirPath;
+	if (_dirPath[_dirPath.length() - 1] != '/' && _dirPath[_dirPath.length() - 1] != '\\')
+		_dirPath += '/';
+	return 0x00;
+}
+
+UINT64 PCMCache::Hash(const void* data, size_t size, UINT64 hash)
+{
+	const UINT8* bytes = (const UINT8*)data;
+	size_t curPos;
+	
+	for (curPos = 0; curPos < size; curPos ++)
+	{
+		hash ^= bytes[curPos];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+UINT64 PCMCache::GetKey(const void* songData, size_t songSize, const GeneralOptions& gOpts, UINT32 fadeTime,
+                        size_t cOptCnt, const ChipOptions* cOpts)
+{
+	UINT64 hash;
+	UINT8 cacheVer = CACHE_VERSION;
+	size_t curChip;
+	
+	// The structures are hashed member by member, so that padding bytes and unrelated options
+	// (audio driver, display settings, ...) don't change the key.
+	hash = Hash(&cacheVer, sizeof(cacheVer));
+	hash = Hash(songData, songSize, hash);
+	hash = Hash(&gOpts.smplRate, sizeof(gOpts.smplRate), hash);
+	hash = Hash(&gOpts.smplFmt, sizeof(gOpts.smplFmt), hash);
+	hash = Hash(&gOpts.pbRate, sizeof(gOpts.pbRate), hash);
+	hash = Hash(&gOpts.volume, sizeof(gOpts.volume), hash);
+	hash = Hash(&gOpts.maxLoops, sizeof(gOpts.maxLoops), hash);
+	hash = Hash(&gOpts.resmplMode, sizeof(gOpts.resmplMode), hash);
+	hash = Hash(&gOpts.chipSmplMode, sizeof(gOpts.chipSmplMode), hash);
+	hash = Hash(&gOpts.chipSmplRate, sizeof(gOpts.chipSmplRate), hash);
+	hash = Hash(&fadeTime, sizeof(fadeTime), hash);
+	hash = Hash(&gOpts.pauseTime_jingle, sizeof(gOpts.pauseTime_jingle), hash);
+	hash = Hash(&gOpts.pauseTime_loop, sizeof(gOpts.pauseTime_loop), hash);
+	hash = Hash(&gOpts.pseudoSurround, sizeof(gOpts.pseudoSurround), hash);
+	hash = Hash(&gOpts.hardStopOld, sizeof(gOpts.hardStopOld), hash);
+	// raw logs are faded out by a render command, which always uses the single-song fade time
+	hash = Hash(&gOpts.fadeRawLogs, sizeof(gOpts.fadeRawLogs), hash);
+	if (gOpts.fadeRawLogs)
+		hash = Hash(&gOpts.fadeTime_single, sizeof(gOpts.fadeTime_single), hash);
+	for (curChip = 0; curChip < cOptCnt; curChip ++)
+	{
+		const ChipOptions& cOpt = cOpts[curChip];
+		hash = Hash(&cOpt.chipType, sizeof(cOpt.chipType), hash);
+		hash = Hash(&cOpt.chipInstance, sizeof(cOpt.chipInstance), hash);
+		hash = Hash(&cOpt.chipDisable, sizeof(cOpt.chipDisable), hash);
+		hash = Hash(&cOpt.emuCore, sizeof(cOpt.emuCore), hash);
+		hash = Hash(&cOpt.emuCoreSub, sizeof(cOpt.emuCoreSub), hash);
+		hash = Hash(cOpt.muteMask, sizeof(cOpt.muteMask), hash);
+		hash = Hash(cOpt.panMask, sizeof(cOpt.panMask), hash);
+		hash = Hash(&cOpt.addOpts, sizeof(cOpt.addOpts), hash);
+	}
+	return hash;
+}
+
+UINT8 PCMCache::Load(UINT64 key, UINT32 smplSize, std::vector<UINT8>& pcmData)
+{
+	std::string filePath;
+	FILE* hFile;
+	UINT8 hdr[CACHE_HDR_SIZE];
+	std::vector<UINT8> compData;
+	UINT32 dataSize;
+	uLongf decSize;
+	UINT8 filter;
+	int retVal;
+	
+	if (! IsEnabled())
+		return 0xFF;
+	
+	filePath = GetFilePath(key);
+	hFile = fopen_utf8(filePath, "rb");
+	if (hFile == NULL)
+		return 0xFF;	// not cached
+	
+	if (fread(hdr, 1, CACHE_HDR_SIZE, hFile) < CACHE_HDR_SIZE || memcmp(&hdr[0x00], "VPCM", 4) ||
+		hdr[0x04] != CACHE_VERSION || ReadLE32(&hdr[0x08]) != (UINT32)key || ReadLE32(&hdr[0x0C]) != (UINT32)(key >> 32))
+	{
+		fclose(hFile);
+		return 0x80;	// not a cache file or hash collision in the file name
+	}
+	if (hdr[0x05] != smplSize)
+	{
+		fclose(hFile);
+		return 0x81;	// should not happen, the sample format is part of the key
+	}
+	filter = hdr[0x06];
+	dataSize = ReadLE32(&hdr[0x10]);
+	compData.resize(ReadLE32(&hdr[0x14]));
+	if (compData.empty() || fread(&compData[0], 1, compData.size(), hFile) < compData.size())
+	{
+		fclose(hFile);
+		return 0x82;	// truncated file
+	}
+	fclose(hFile);
+	
+	pcmData.resize(dataSize);
+	decSize = dataSize;
+	retVal = uncompress(pcmData.empty() ? NULL : &pcmData[0], &decSize, &compData[0], (uLong)compData.size());
+	if (retVal != Z_OK || decSize != dataSize)
+	{
+		pcmData.clear();
+		return 0x83;
+	}
+	RemoveDeltaFilter(filter, pcmData);
+	
+	utime(filePath.c_str(), NULL);	// mark as "recently used"
+	return 0x00;
+}
+
+UINT8 PCMCache::Store(UINT64 key, UINT32 smplSize, UINT8* pcmData, size_t pcmSize)
+{
+	std::string filePath;
+	std::string tempPath;
+	FILE* hFile;
+	UINT8 hdr[CACHE_HDR_SIZE];
+	std::vector<UINT8> compBuf;
+	z_stream zStrm;
+	UINT32 compSize;
+	UINT8 filter;
+	bool writeError;
+	int retVal;
+	
+	if (! IsEnabled() || ! pcmSize || pcmSize > 0xFFFFFFFF)
+		return 0xFF;
+	
+	// the data is filtered in place, as the caller discards it afterwards
+	filter = GetFilter(smplSize);
+	ApplyDeltaFilter(filter, pcmData, pcmSize);
+	
+	memcpy(&hdr[0x00], "VPCM", 4);
+	hdr[0x04] = CACHE_VERSION;
+	hdr[0x05] = (UINT8)smplSize;
+	hdr[0x06] = filter;
+	hdr[0x07] = 0x00;
+	WriteLE32(&hdr[0x08], (UINT32)key);
+	WriteLE32(&hdr[0x0C], (UINT32)(key >> 32));
+	WriteLE32(&hdr[0x10], (UINT32)pcmSize);
+	WriteLE32(&hdr[0x14], 0);	// written after compressing
+	
+	// write to a temporary file first, so that an interrupted write never leaves a broken cache entry
+	filePath = GetFilePath(key);
+	tempPath = filePath + ".tmp";
+	hFile = fopen_utf8(tempPath, "wb");
+	if (hFile == NULL)
+		return 0xC0;
+	
+	// The data is compressed in chunks straight into the file, so that only a small buffer is needed.
+	// The fastest level is used, so that the writer is done before the next song ends.
+	memset(&zStrm, 0x00, sizeof(z_stream));
+	if (deflateInit(&zStrm, Z_BEST_SPEED) != Z_OK)
+	{
+		fclose(hFile);
+		remove(tempPath.c_str());
+		return 0x80;
+	}
+	compBuf.resize(COMP_CHUNK_SIZE);
+	writeError = false;
+	if (fwrite(hdr, 1, CACHE_HDR_SIZE, hFile) < CACHE_HDR_SIZE)
+		writeError = true;
+	zStrm.next_in = pcmData;
+	zStrm.avail_in = (uInt)pcmSize;
+	compSize = 0;
+	do
+	{
+		zStrm.next_out = &compBuf[0];
+		zStrm.avail_out = (uInt)compBuf.size();
+		retVal = deflate(&zStrm, Z_FINISH);
+		size_t outSize = compBuf.size() - zStrm.avail_out;
+		if (fwrite(&compBuf[0], 1, outSize, hFile) < outSize)
+			writeError = true;
+		compSize += (UINT32)outSize;
+	} while(retVal == Z_OK && ! writeError);
+	deflateEnd(&zStrm);
+	if (retVal != Z_STREAM_END && ! writeError)
+	{
+		fclose(hFile);
+		remove(tempPath.c_str());
+		return 0x80;
+	}
+	WriteLE32(&hdr[0x14], compSize);
+	if (fseek(hFile, 0, SEEK_SET) || fwrite(hdr, 1, CACHE_HDR_SIZE, hFile) < CACHE_HDR_SIZE)
+		writeError = true;
+	if (fclose(hFile))
+		writeError = true;
+	if (writeError)
+	{
+		remove(tempPath.c_str());
+		return 0xC1;	// probably out of disk space
+	}
+#ifdef _WIN32
+	remove(filePath.c_str());	// rename() doesn't replace existing files on Windows
+#endif
+	if (rename(tempPath.c_str(), filePath.c_str()))
+	{
+		remove(tempPath.c_str());
+		return 0xC2;
+	}
+	
+	TrimCache();
+	return 0x00;
+}
+
+std::string PCMCache::GetFilePath(UINT64 key) const
+{
+	char fileName[0x20];
+	
+	sprintf(fileName, "%08X%08X", (UINT32)(key >> 32), (UINT32)key);
+	return _dirPath + fileName + CACHE_FILE_EXT;
+}
+
+void PCMCache::TrimCache(void)
+{
+	std::vector<CacheFileInfo> files;
+	UINT64 totalSize;
+	size_t curFile;
+	
+	if (! _maxSize)
+		return;	// no limit
+	if (! ListCacheFiles(_dirPath, files))
+		return;
+	
+	totalSize = 0;
+	for (curFile = 0; curFile < files.size(); curFile ++)
+		totalSize += files[curFile].size;
+	if (totalSize <= _maxSize)
+		return;
+	
+	// remove the least recently used files (oldest modification time) until the cache fits
+	std::sort(files.begin(), files.end(), CompareMTime);
+	for (curFile = 0; curFile < files.size() && totalSize > _maxSize; curFile ++)
+	{
+		if (! remove(files[curFile].path.c_str()))
+			totalSize -= files[curFile].size;
+	}
+	
+	return;
+}
+
+static UINT8 GetFilter(UINT32 smplSize)
+{
+	// The output is always stereo. Neighbouring samples are similar, so storing the difference
+	// to the previous one helps zlib a lot.
+	if (smplSize == 2 * sizeof(INT16))
+		return FILTER_DELTA16;
+	else if (smplSize == 2 * sizeof(INT32))
+		return FILTER_DELTA32;
+	else
+		return FILTER_NONE;
+}
+
+static void ApplyDeltaFilter(UINT8 filter, UINT8* data, size_t size)
+{
+	size_t curSmpl;
+	
+	// go backwards, so that each difference uses the original value of the previous sample
+	if (filter == FILTER_DELTA16)
+	{
+		INT16* smpls = (INT16*)data;
+		for (curSmpl = size / sizeof(INT16); curSmpl > 2; curSmpl --)
+			smpls[curSmpl - 1] = (INT16)(smpls[curSmpl - 1] - smpls[curSmpl - 3]);
+	}
+	else if (filter == FILTER_DELTA32)
+	{
+		INT32* smpls = (INT32*)data;
+		for (curSmpl = size / sizeof(INT32); curSmpl > 2; curSmpl --)
+			smpls[curSmpl - 1] = (INT32)((UINT32)smpls[curSmpl - 1] - (UINT32)smpls[curSmpl - 3]);
+	}
+	
+	return;
+}
+
+static void RemoveDeltaFilter(UINT8 filter, std::vector<UINT8>& data)
+{
+	size_t smplCnt;
+	size_t curSmpl;
+	
+	if (filter == FILTER_DELTA16)
+	{
+		INT16* smpls = (INT16*)&data[0];
+		smplCnt = data.size() / sizeof(INT16);
+		for (curSmpl = 2; curSmpl < smplCnt; curSmpl ++)
+			smpls[curSmpl] = (INT16)(smpls[curSmpl] + smpls[curSmpl - 2]);
+	}
+	else if (filter == FILTER_DELTA32)
+	{
+		INT32* smpls = (INT32*)&data[0];
+		smplCnt = data.size() / sizeof(INT32);
+		for (curSmpl = 2; curSmpl < smplCnt; curSmpl ++)
+			smpls[curSmpl] = (INT32)((UINT32)smpls[curSmpl] + (UINT32)smpls[curSmpl - 2]);
+	}
+	
+	return;
+}
+
+static bool ListCacheFiles(const std::string& dirPath, std::vector<CacheFileInfo>& files)
+{
+	CacheFileInfo cfi;
+	
+#ifdef _WIN32
+	struct _finddata_t findData;
+	intptr_t hFind;
+	
+	hFind = _findfirst((dirPath + "*" CACHE_FILE_EXT).c_str(), &findData);
+	if (hFind == -1)
+		return false;
+	do
+	{
+		cfi.path = dirPath + findData.name;
+		cfi.mtime = findData.time_write;
+		cfi.size = findData.size;
+		files.push_back(cfi);
+	} while(! _findnext(hFind, &findData));
+	_findclose(hFind);
+#else
+	const size_t extLen = strlen(CACHE_FILE_EXT);
+	DIR* hDir;
+	struct dirent* dirEntry;
+	struct stat fileStat;
+	
+	hDir = opendir(dirPath.c_str());
+	if (hDir == NULL)
+		return false;
+	while((dirEntry = readdir(hDir)) != NULL)
+	{
+		size_t nameLen = strlen(dirEntry->d_name);
+		if (nameLen <= extLen || strcmp(&dirEntry->d_name[nameLen - extLen], CACHE_FILE_EXT))
+			continue;
+		cfi.path = dirPath + dirEntry->d_name;
+		if (stat(cfi.path.c_str(), &fileStat))
+			continue;
+		cfi.mtime = fileStat.st_mtime;
+		cfi.size = (UINT64)fileStat.st_size;
+		files.push_back(cfi);
+	}
+	closedir(hDir);
+#endif
+	
+	return true;
+}
+
+static bool CompareMTime(const CacheFileInfo& a, const CacheFileInfo& b)
+{
+	return a.mtime < b.mtime;
+}
+
+static inline UINT32 ReadLE32(const UINT8* buffer)
+{
+	return	(buffer[0x00] <<  0) | (buffer[0x01] <<  8) |
+			(buffer[0x02] << 16) | ((UINT32)buffer[0x03] << 24);
+}
+
+static inline void WriteLE32(UINT8* buffer, UINT32 value)
+{
+	buffer[0x00] = (UINT8)((value >>  0) & 0xFF);
+	buffer[0x01] = (UINT8)((value >>  8) & 0xFF);
+	buffer[0x02] = (UINT8)((value >> 16) & 0xFF);
+	buffer[0x03] = (UINT8)((value >> 24) & 0xFF);
+	return;
+}
@@ -0,0 +1,44 @@
+#ifndef __PCMCACHE_HPP__
+#define __PCMCACHE_HPP__
+
+#include <string>
+#include <vector>
+#include <stdtype.h>
+
+struct GeneralOptions;
+struct ChipOptions;
+
+// on-disk cache of rendered songs
+// Each song is stored in its own zlib-compressed file, the least recently used files are removed
+// when the cache grows above its size limit.
+class PCMCache
+{
+public:
+	PCMCache();
+	
+	// empty directory = cache disabled
+	UINT8 SetDirectory(const std::string& dirPath, UINT64 maxSize);
+	bool IsEnabled(void) const	{ return ! _dirPath.empty(); }
+	UINT64 GetMaxSize(void) const	{ return _maxSize; }
+	
+	// FNV-1a hash, pass the result of the previous call as "hash" to add more data
+	static UINT64 Hash(const void* data, size_t size, UINT64 hash = 0xCBF29CE484222325ULL);
+	// key over the song data and all options that change the rendered audio
+	// fadeTime: fade-out in ms, as FadeTime/FadeTimePL depend on the song's position in the playlist
+	static UINT64 GetKey(const void* songData, size_t songSize, const GeneralOptions& gOpts, UINT32 fadeTime,
+	                     size_t cOptCnt, const ChipOptions* cOpts);
+	
+	// smplSize: bytes per sample (all channels), must match the stored data
+	UINT8 Load(UINT64 key, UINT32 smplSize, std::vector<UINT8>& pcmData);
+	// Store modifies pcmData. It may run in another thread than Load.
+	UINT8 Store(UINT64 key, UINT32 smplSize, UINT8* pcmData, size_t pcmSize);
+	
+private:
+	std::string GetFilePath(UINT64 key) const;
+	void TrimCache(void);
+	
+	std::string _dirPath;
+	UINT64 _maxSize;
+};
+
+#endif	// __PCMCACHE_HPP__
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 #include <vector>
 #include <string>
@@ -30,6 +31,7 @@
 
 #include "config.hpp"
 #include "playcfg.hpp"
+#include "utils.hpp"	// for THRSCHED_* constants
 
 
 struct ChipCfgSectDef
@@ -53,6 +55,9 @@ static inline unsigned long Cfg_GetUIntOrDefault(const CfgSection::Unordered& ce
 static inline double Cfg_GetFloatOrDefault(const CfgSection::Unordered& ceList, const std::string& entryName, double defaultValue);
 static inline bool Cfg_GetBoolOrDefault(const CfgSection::Unordered& ceList, const std::string& entryName, bool defaultValue);
 static std::vector<std::string> Cfg_Str2VectStr(const std::string& text);
+static UINT8 Cfg_Str2SmplFmt(const std::string& text);
+static UINT8 Cfg_Str2SchedPolicy(const std::string& text);
+static std::vector<unsigned int> Cfg_Str2CPUList(const std::string& text);
 static void ParseCfg_General(GeneralOptions& opts, const CfgSection& cfg);
 static void ParseCfg_ChipSection(ChipOptions& opts, const CfgSection& cfg, UINT8 chipType);
 
@@ -185,12 +190,67 @@ static std::vector<std::string> Cfg_Str2VectStr(const std::string& text)
 	return result;
 }
 
+static UINT8 Cfg_Str2SmplFmt(const std::string& text)
+{
+	if (! stricmp(text.c_str(), "s24") || text == "24")
+		return SMPLFMT_S24;
+	else if (! stricmp(text.c_str(), "s32") || text == "32")
+		return SMPLFMT_S32;
+	else if (! stricmp(text.c_str(), "f32") || ! stricmp(text.c_str(), "float"))
+		return SMPLFMT_F32;
+	else
+		return SMPLFMT_S16;
+}
+
+static UINT8 Cfg_Str2SchedPolicy(const std::string& text)
+{
+	if (! stricmp(text.c_str(), "nice"))
+		return THRSCHED_NICE;
+	else if (! stricmp(text.c_str(), "fifo"))
+		return THRSCHED_FIFO;
+	else if (! stricmp(text.c_str(), "rr"))
+		return THRSCHED_RR;
+	else
+		return THRSCHED_NORMAL;
+}
+
+// "0,2-3" -> {0, 2, 3}
+static std::vector<unsigned int> Cfg_Str2CPUList(const std::string& text)
+{
+	std::vector<unsigned int> cpuList;
+	const char* strPtr = text.c_str();
+	
+	while(*strPtr != '\0')
+	{
+		char* endPtr;
+		unsigned long firstCPU = strtoul(strPtr, &endPtr, 0);
+		unsigned long lastCPU = firstCPU;
+		if (endPtr == strPtr)
+			break;	// invalid character
+		strPtr = endPtr;
+		if (*strPtr == '-')
+		{
+			strPtr ++;
+			lastCPU = strtoul(strPtr, &endPtr, 0);
+			if (endPtr == strPtr)
+				break;
+			strPtr = endPtr;
+		}
+		for (; firstCPU <= lastCPU && firstCPU < 0x400; firstCPU ++)
+			cpuList.push_back((unsigned int)firstCPU);
+		while(*strPtr == ',' || *strPtr == ' ')
+			strPtr ++;
+	}
+	return cpuList;
+}
+
 static void ParseCfg_General(GeneralOptions& opts, const CfgSection& cfg)
 {
 	const CfgSection::Unordered& ceList = cfg.unord;
 	CfgSection::Unordered::const_iterator ceIt;	// config entry iterator
 	
 	opts.smplRate =		(UINT32)Cfg_GetUIntOrDefault(ceList, "SampleRate", 44100);
+	opts.smplFmt =		Cfg_Str2SmplFmt(Cfg_GetStrOrDefault(ceList, "SampleFormat", "s16"));
 	opts.pbRate =		(UINT32)Cfg_GetUIntOrDefault(ceList, "PlaybackRate", 0);
 	opts.volume =		(double)Cfg_GetFloatOrDefault(ceList, "Volume", 1.0);
 	opts.maxLoops =		(UINT32)Cfg_GetUIntOrDefault(ceList, "MaxLoops", 2);
@@ -205,10 +265,13 @@ static void ParseCfg_General(GeneralOptions& opts, const CfgSection& cfg)
 	opts.pauseTime_loop =	(UINT32)Cfg_GetUIntOrDefault(ceList, "FadePause", 0);
 	
 	opts.pbMode =			 (UINT8)Cfg_GetUIntOrDefault(ceList, "LogSound", 0);
+	opts.logBufTime =		(UINT32)Cfg_GetUIntOrDefault(ceList, "LogBufferTime", 2000);
 	opts.soundWhilePaused =	  (bool)Cfg_GetBoolOrDefault(ceList, "EmulatePause", false);
 	opts.pseudoSurround =	  (bool)Cfg_GetBoolOrDefault(ceList, "SurroundSound", false);
 	opts.preferJapTag =		  (bool)Cfg_GetBoolOrDefault(ceList, "PreferJapTag", false);
 	opts.showDevCore =		  (bool)Cfg_GetBoolOrDefault(ceList, "ShowChipCore", false);
+	opts.showRenderLoad =	 (UINT8)Cfg_GetUIntOrDefault(ceList, "ShowRenderLoad", 0);
+	opts.showPlayStats =	 (UINT8)Cfg_GetUIntOrDefault(ceList, "ShowPlaybackStats", 0);
 	opts.setTermTitle =		  (bool)Cfg_GetBoolOrDefault(ceList, "SetTerminalTitle", true);
 	{
 		std::string hsStr = Cfg_GetStrOrDefault(ceList, "HardStopOld", "0");
@@ -226,7 +289,23 @@ static void ParseCfg_General(GeneralOptions& opts, const CfgSection& cfg)
 		opts.audDriverID = (UINT32)-1;
 	opts.audBufCnt =		(UINT32)Cfg_GetUIntOrDefault(ceList, "AudioBuffers", 0);
 	opts.audBufTime =		(UINT32)Cfg_GetUIntOrDefault(ceList, "AudioBufferSize", 0);
+	opts.adaptiveBuf =		  (bool)Cfg_GetBoolOrDefault(ceList, "AdaptiveBuffers", false);
 	opts.audOutDev =		(UINT32)Cfg_GetUIntOrDefault(ceList, "OutputDevice", 0);
+	opts.renderAhead =		(UINT32)Cfg_GetUIntOrDefault(ceList, "RenderAhead", 0);
+	opts.seekHistory =		(UINT32)Cfg_GetUIntOrDefault(ceList, "SeekHistory", 0);
+	opts.renderThreads =	(UINT32)Cfg_GetUIntOrDefault(ceList, "RenderThreads", 0);
+	opts.renderStems =		  (bool)Cfg_GetBoolOrDefault(ceList, "RenderStems", false);
+	opts.preloadNext =		  (bool)Cfg_GetBoolOrDefault(ceList, "PreloadNextSong", true);
+	opts.prefetchSongs =	(UINT32)Cfg_GetUIntOrDefault(ceList, "PrefetchSongs", 3);
+	opts.prefetchSize =		(UINT32)Cfg_GetUIntOrDefault(ceList, "PrefetchSize", 64);
+	opts.renderSched = Cfg_Str2SchedPolicy(Cfg_GetStrOrDefault(ceList, "RenderScheduling", "normal"));
+	opts.renderPrio =		 (INT32)atoi(Cfg_GetStrOrDefault(ceList, "RenderPriority", "0").c_str());
+	opts.renderCPUs = Cfg_Str2CPUList(Cfg_GetStrOrDefault(ceList, "RenderCPUs", ""));
+	opts.lockMemory =		  (bool)Cfg_GetBoolOrDefault(ceList, "LockMemory", false);
+	opts.pcmCacheDir =				Cfg_GetStrOrDefault(ceList, "PCMCacheDir", "");
+	opts.pcmCacheSize =		(UINT32)Cfg_GetUIntOrDefault(ceList, "PCMCacheSize", 1024);
+	opts.auxCacheSize =		(UINT32)Cfg_GetUIntOrDefault(ceList, "AuxFileCacheSize", 32);
+	opts.songIndexFile =			Cfg_GetStrOrDefault(ceList, "SongIndexFile", "");
 	
 	return;
 }
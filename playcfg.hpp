@@ -3,10 +3,18 @@
 
 #include <stdtype.h>
 #include <string>
+#include <vector>
+
+// output sample formats
+#define SMPLFMT_S16		0x00	// 16-bit signed integer
+#define SMPLFMT_S24		0x01	// 24-bit signed integer
+#define SMPLFMT_S32		0x02	// 32-bit signed integer
+#define SMPLFMT_F32		0x03	// 32-bit float, rendered as 32-bit integer and converted afterwards
 
 struct GeneralOptions
 {
 	UINT32 smplRate;
+	UINT8 smplFmt;	// output sample format (SMPLFMT_*)
 	UINT32 pbRate;
 	double volume;
 	UINT32 maxLoops;
@@ -21,10 +29,13 @@ struct GeneralOptions
 	UINT32 pauseTime_loop;
 	
 	UINT8 pbMode;	// playback mode (0 = play, 1 = log to WAV, 2 = play+log)
+	UINT32 logBufTime;	// play+log: buffer of the disk writer thread in ms (0 = write in the audio callback)
 	bool soundWhilePaused;
 	bool pseudoSurround;
 	bool preferJapTag;
 	bool showDevCore;
+	UINT8 showRenderLoad;	// 0 - off, 1 - in the status line, 2 - also print a summary at the end of the song
+	UINT8 showPlayStats;	// dropout statistics: 0 - off, 1 - print at exit, 2 - also in the status line
 	bool setTermTitle;
 	UINT8 hardStopOld;
 	bool fadeRawLogs;
@@ -35,6 +46,22 @@ struct GeneralOptions
 	UINT32 audOutDev;
 	UINT32 audBufCnt;
 	UINT32 audBufTime;
+	bool adaptiveBuf;	// raise/lower the number of audio buffers depending on dropouts
+	UINT32 renderAhead;	// time to render ahead of the audio device in ms (0 = render in audio callback)
+	UINT32 seekHistory;	// seconds of played audio that are kept for seeking back (needs renderAhead)
+	UINT32 renderThreads;	// number of songs rendered in parallel in batch mode (0 = one per CPU core)
+	bool renderStems;	// batch mode: write one WAV file per sound chip
+	bool preloadNext;	// load the next song of the playlist in the background
+	UINT32 prefetchSongs;	// number of following songs whose files are read into the OS file cache
+	UINT32 prefetchSize;	// maximum amount of data for that in MB
+	UINT8 renderSched;	// scheduling of the thread that renders the audio (THRSCHED_*)
+	INT32 renderPrio;	// nice value or real-time priority
+	std::vector<unsigned int> renderCPUs;	// CPU cores for the render thread (empty = all)
+	bool lockMemory;	// keep the player's memory from being paged out
+	std::string pcmCacheDir;	// directory for storing rendered songs (empty = no cache)
+	UINT32 pcmCacheSize;	// size limit of the cache in MB (0 = unlimited)
+	UINT32 auxCacheSize;	// memory for files requested by the players (e.g. sample ROMs) in MB
+	std::string songIndexFile;	// index of song information (empty = no index)
 };
 struct ChipOptions
 {
@@ -56,4 +83,14 @@ void ParseConfiguration(GeneralOptions& gOpts, size_t cOptCnt, ChipOptions* cOpt
 void ApplyCfg_General(PlayerA& player, const GeneralOptions& opts);
 void ApplyCfg_Chip(PlayerA& player, const GeneralOptions& gOpts, const ChipOptions& cOpts);
 
+static inline UINT8 SmplFmt_GetBits(UINT8 smplFmt)
+{
+	if (smplFmt == SMPLFMT_S16)
+		return 16;
+	else if (smplFmt == SMPLFMT_S24)
+		return 24;
+	else
+		return 32;
+}
+
 #endif	// __PLAYCFG_HPP__
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <vector>
 #include <string>
 #include <math.h>
@@ -12,10 +13,11 @@
 extern "C" int __cdecl _getch(void);	// from conio.h
 extern "C" int __cdecl _kbhit(void);
 #else
-#include <unistd.h>		// for STDIN_FILENO and usleep()
+#include <unistd.h>		// for STDIN_FILENO
 #include <termios.h>
 #include <sys/time.h>	// for struct timeval in _kbhit()
-#define	Sleep(msec)	usleep(msec * 1000)
+#include <poll.h>
+#include <fcntl.h>
 #endif
 
 #ifdef _MSC_VER
@@ -24,7 +26,6 @@ extern "C" int __cdecl _kbhit(void);
 
 #include <stdtype.h>
 #include <utils/DataLoader.h>
-#include <utils/FileLoader.h>
 #include <player/playerbase.hpp>
 #include <player/s98player.hpp>
 #include <player/droplayer.hpp>
@@ -33,6 +34,8 @@ extern "C" int __cdecl _kbhit(void);
 #include <audio/AudioStream.h>
 #include <audio/AudioStream_SpcDrvFuns.h>
 #include <utils/OSMutex.h>
+#include <utils/OSSignal.h>
+#include <utils/OSThread.h>
 #include <utils/StrUtils.h>
 
 #include "utils.hpp"
@@ -42,6 +45,10 @@ extern "C" int __cdecl _kbhit(void);
 #include "mediainfo.hpp"
 #include "version.h"
 #include "mediactrl.hpp"
+#include "spscring.hpp"
+#include "loaders.hpp"
+#include "pcmcache.hpp"
+#include "songindex.hpp"
 
 
 struct AudioDriver
@@ -54,33 +61,78 @@ struct AudioDriver
 	void* data;				// data structure
 };
 
+struct RenderCmd
+{
+	UINT8 type;		// MI_EVT_* event type
+	INT32 param;
+};
+
 
 UINT8 PlayerMain(UINT8 showFileName);
 static bool AdvanceSongList(size_t& songIdx, int controlVal);
-static DATA_LOADER* GetFileLoaderUTF8(const std::string& fileName);
+static UINT8 LoadFileData(const std::string& fileName, DATA_LOADER*& dLoad);
 static UINT8 OpenFile(const std::string& fileName, DATA_LOADER*& dLoad, PlayerBase*& player);
+static void PreloadThread(void* args);
+static void StartPreload(size_t songIdx);
+static DATA_LOADER* FinishPreload(size_t songIdx);
+static void PrefetchThread(void* args);
+static void StartPrefetch(size_t songIdx, int direction);
+static void StopPrefetch(void);
 static void PreparePlayback(void);
 static void ShowSongInfo(void);
 static void ShowConsoleTitle(void);
 static UINT8 PlayFile(void);
 static UINT8 HandleCtrlEvent(UINT8 evtType, INT32 evtParam);
+static bool PushRenderCmd(UINT8 type, INT32 param);
+static void ApplyRenderCmds(PlayerA& player);
+static UINT32 GetPlaybackSample(PlayerA& player);
+static bool SeekRenderedPCM(PlayerA& player, UINT32 smplPos);
+static void DiscardRenderedPCM(void);
+static void PrepareCachedPCM(DATA_LOADER* dLoad);
+static void FinishCachedPCM(void);
+static void CacheWriteThread(void* args);
+static void FinishCacheWrite(void);
+static void UpdateSongIndex(const std::string& fileName);
+static UINT32 GetRenderSample(PlayerA& player);
+static void SeekRenderPos(PlayerA& player, UINT8 posType, UINT32 pos);
+static void LeaveCachedPCM(PlayerA& player);
+static bool IsRenderEnd(PlayerA& player);
+static double GetCachedPCMTime(PlayerA& player);
 
 static int GetPressedKey(void);
 static UINT8 HandleKeyPress(bool waitForKey);
 static INT8 GetTimeDispMode(double seconds);
 static std::string GetTimeStr(double seconds, INT8 showHours = 0);
+static UINT32 RenderMeasured(PlayerA& player, UINT32 bufSize, void* data);
+static UINT32 RenderAudio(PlayerA& player, UINT32 bufSize, void* data);
+static void CountAudioBuffer(UINT32 bufSize);
+static UINT32 GetRenderTimePercentile(UINT32 permille);
+static void PrintPlaybackStats(void);
 static UINT32 FillBuffer(void* drvStruct, void* userParam, UINT32 bufSize, void* Data);
 static UINT32 FillBufferDummy(void* drvStruct, void* userParam, UINT32 bufSize, void* data);
+static UINT32 FillBufferAhead(void* drvStruct, void* userParam, UINT32 bufSize, void* data);
+static bool RenderAheadChunk(PlayerA& player);
+static void RenderThread(void* args);
+static UINT8 StartRenderThread(void);
+static void StopRenderThread(void);
+static void ApplyRenderThreadOpts(const char* thrName);
 static UINT8 FilePlayCallback(PlayerBase* player, void* userParam, UINT8 evtType, void* evtParam);
-static DATA_LOADER* PlayerFileReqCallback(void* userParam, PlayerBase* player, const char* fileName);
 static UINT8 ChooseAudioDriver(AudioDriver* aDrv);
 static UINT8 InitAudioDriver(AudioDriver* aDrv);
 static UINT8 InitAudioSystem(void);
 static UINT8 DeinitAudioSystem(void);
 static UINT8 StartAudioDevice(void);
 static UINT8 StopAudioDevice(void);
+static void AdaptAudioBuffers(void);
 static UINT8 StartDiskWriter(const std::string& songFileName);
 static UINT8 StopDiskWriter(void);
+static void LogAudioData(const void* data, UINT32 size);
+static void DiskWriterThread(void* args);
+static UINT8 InitMainLoopWait(void);
+static void DeinitMainLoopWait(void);
+static void WakeMainLoop(void);
+static void WaitForMainLoopEvent(UINT32 timeoutMS);
+static void MediaEventCB(MediaInfo* mInfo, void* userParam);
 #ifndef _WIN32
 static void changemode(UINT8 noEcho);
 static int _kbhit(void);
@@ -106,21 +158,112 @@ static AudioDriver adOut /*= {ADRVTYPE_OUT, -1, "", 0, 0, NULL}*/;
 static AudioDriver adLog /*= {ADRVTYPE_DISK, -1, "", 0, 0, NULL}*/;
 
 static std::vector<UINT8> audioBuf;
-static OS_MUTEX* renderMtx;	// render thread mutex
+static SPSCRing<RenderCmd> renderCmdQueue;	// control thread -> render thread, applied at buffer boundaries
+static volatile UINT32 renderPosChgCnt = 0;	// incremented by the render thread after changing the position
+
+// render-ahead mode: a separate thread keeps the PCM ring filled, the audio callback only copies data
+static bool renderAhead = false;
+static UINT32 renderAheadBytes = 0;		// lead of the render thread (0 = render in audio callback)
+static std::vector<UINT8> renderBuf;	// render thread buffer, one audio driver buffer large
+static SPSCRing<UINT8> pcmRing;			// render thread -> audio callback
+static OS_THREAD* renderThread = NULL;
+static OS_SIGNAL* renderWakeSig = NULL;	// wakes the render thread when there is space or a command
+static volatile bool renderThreadStop = false;
+static volatile bool renderEnd = false;	// render thread reached the end of the song
+static volatile UINT32 pcmDiscardPos = 0;	// the audio callback continues reading at this ring position after seeking
+static volatile UINT32 pcmDiscardCnt = 0;
+static UINT32 pcmDiscardSeen = 0;
+static bool pcmRefilling = false;	// audio callback: the ring may run empty after seeking, this isn't a dropout
+static UINT32 pcmSmplSize = 0;		// bytes per sample of the rendered audio
+// seek history: audio that was played already stays in the ring, so seeking back within it doesn't need to emulate the song again
+static UINT32 pcmHistBytes = 0;		// amount of played audio that is kept (0 = off)
+static UINT32 pcmHistStart = 0;		// ring position of the oldest audio that belongs to the current playback
+static bool pcmSeekValid = false;	// render thread: pcmSeekPos needs to be sent to the audio callback
+static UINT32 pcmSeekPos = 0;
+
+// disk writer: in play+log mode, the audio callback only copies the data into diskRing
+// and a separate thread writes it to the file in large blocks
+static SPSCRing<UINT8> diskRing;		// audio callback -> disk writer thread
+static OS_THREAD* diskThread = NULL;
+static OS_SIGNAL* diskWakeSig = NULL;
+static volatile bool diskThreadStop = false;
+static UINT32 diskBlockSize = 0;		// the file is written in blocks of this size
+static volatile UINT32 diskDropBytes = 0;	// audio that didn't fit into the ring (written by the audio callback)
+static UINT32 diskLateBlocks = 0;	// blocks whose writing took longer than playing them
+
+// adaptive buffering: more audio buffers after dropouts, fewer again after a longer time without problems
+static UINT32 adaptBufCnt = 0;		// number of audio buffers in use (0 = not adaptive)
+static UINT32 adaptBufMin = 0;
+static double adaptStableTime = 0.0;	// seconds played without deadline misses
+static UINT32 adaptBufStart = 0;	// statistics counters at the start of the song
+static UINT32 adaptMissStart = 0;
+static UINT32 audBufUSec = 0;		// length of one audio driver buffer in microseconds
+
+// playback statistics: written by the audio callback (render thread for the render times), read by the main thread
+#define RTIME_HIST_SIZE	401	// render time in % of the buffer length: 0..399 %, last entry: 400 % and more
+static bool statsEnable = false;
+static volatile UINT32 statBufCnt = 0;	// buffers delivered to the audio driver
+static volatile UINT32 statMissCnt = 0;	// buffers that took longer to render than to play (rendering in the audio callback)
+static volatile UINT32 statUnderrunCnt = 0;	// buffers that the render-ahead ring couldn't fill
+static volatile UINT32 statLateCnt = 0;	// audio callbacks that came more than 1.5 buffer lengths after the previous one
+static double statLastBufTime = 0.0;
+static double statLastBufLen = 0.0;
+static UINT32 statRenderHist[RTIME_HIST_SIZE];
+static UINT32 statRenderMaxUSec = 0;
+static UINT32 statCmdDropCnt = 0;	// main thread: render commands that didn't fit into the queue
+
+// preloading: the next song of the list is read and decompressed while the current one plays
+static OS_THREAD* preloadThread = NULL;
+static size_t preloadSongIdx = (size_t)-1;	// songList index of the preloaded file
+static DATA_LOADER* preloadDLoad = NULL;	// NULL when loading failed
+
+// read-ahead: the files of the songs after the next one are pulled into the OS file cache
+static OS_THREAD* prefetchThread = NULL;
+static std::vector<std::string> prefetchFiles;
+static volatile bool prefetchStop = false;
+
+// cache of rendered songs (PCMCacheDir): songs that were played until the end are stored,
+// when they are played again, the audio is read from the cache instead of emulating the sound chips
+static PCMCache pcmCache;
+static UINT64 cacheKey = 0;
+static std::vector<UINT8> cachePCM;	// the whole song (playing from the cache)
+static volatile bool cachePlay = false;	// the render thread reads from cachePCM instead of using the player
+static volatile UINT32 cachePos = 0;	// byte offset of the next sample in cachePCM
+static bool cacheCapture = false;	// render thread: collect the rendered audio for storing it in the cache
+static size_t cacheCaptureMax = 0;	// songs that are larger aren't cached
+static UINT8* cacheCapBuf = NULL;	// audio rendered so far (capturing), allocated for each song by the main thread
+static size_t cacheCapBufSize = 0;	// expected size of the song, capturing stops when the buffer is full
+static size_t cacheCapSize = 0;	// bytes in cacheCapBuf
+// cache writer: a captured song is compressed and written while the next one plays
+static OS_THREAD* cacheWriteThread = NULL;
+static volatile bool cacheWriteDone = false;
+static UINT64 cacheWriteKey = 0;
+static UINT8* cacheWriteBuf = NULL;	// owned by the writer thread until FinishCacheWrite()
+static size_t cacheWriteSize = 0;
+static UINT8 cacheWriteRes = 0x00;
+
+// index of song information (SongIndexFile), new or modified songs are added when they are played
+static SongIndex songIndex;
 
 #ifdef _WIN32
-static CPCONV* cpcU8_Wide;
-#if ! HAVE_FILELOADER_W
-static CPCONV* cpcU8_ACP;
-#endif
+static CPCONV* cpcU8_Wide;	// for the console title
 #endif
 
+// render load: written by the render thread, the main thread calculates the load from the differences
+static volatile UINT32 renderLoadUSec = 0;	// time spent in PlayerA::Render in microseconds (wraps around)
+static volatile UINT32 renderLoadSmpls = 0;	// number of samples rendered during that time (wraps around)
+
+// scheduling options for the threads that render or deliver audio
+static bool cbThreadOptsDone = false;	// audio callback: options were applied to the audio driver's thread
+static bool mainThreadOptsDone = false;	// manual render loop: ... to the main thread
+static bool schedWarnShown = false;
+static bool memLockWarnShown = false;
+
 static bool manualRenderLoop = false;
 static bool dummyRenderAtLoad = false;
 
 static INT8 timeDispMode = 0;
 
-extern std::vector<std::string> appSearchPaths;
 extern Configuration playerCfg;
 extern std::vector<SongFileList> songList;
 extern std::vector<PlaylistFileList> plList;
@@ -163,26 +306,47 @@ UINT8 PlayerMain(UINT8 showFileName)
 		adLog.driverType = ADRVTYPE_DISK;
 	}
 	
+	Loaders_Init();
+	Loaders_SetAuxCacheSize((UINT64)genOpts.auxCacheSize << 20);
+	// Opening the audio device can take a while, load the first song in the meantime.
+	// (compressed files are inflated by a background thread of the loader)
+	if (genOpts.preloadNext && ! songList.empty())
+		StartPreload(0);
+	
 	retVal = InitAudioSystem();
 	if (retVal)
+	{
+		FinishPreload((size_t)-1);
+		Loaders_Deinit();
 		return 1;
+	}
 	retVal = StartAudioDevice();
 	if (retVal)
 	{
+		FinishPreload((size_t)-1);
 		DeinitAudioSystem();
+		Loaders_Deinit();
 		return 1;
 	}
+	statsEnable = (genOpts.showPlayStats > 0 || adaptBufCnt > 0);
+	if (! genOpts.pcmCacheDir.empty())
+	{
+		UINT64 cacheSize = (UINT64)genOpts.pcmCacheSize << 20;
+		retVal = pcmCache.SetDirectory(genOpts.pcmCacheDir, cacheSize);
+		if (retVal)
+			fprintf(stderr, "Warning: Unable to create the cache directory %s!\n", genOpts.pcmCacheDir.c_str());
+		// a single song may use 1/4 of the cache, but never more than 1 GB of memory
+		cacheCaptureMax = 0x40000000;
+		if (cacheSize > 0 && cacheCaptureMax > cacheSize / 4)
+			cacheCaptureMax = (size_t)(cacheSize / 4);
+	}
+	retVal = songIndex.Open(genOpts.songIndexFile);
+	if (retVal)
+		fprintf(stderr, "Warning: Unable to open the song index %s!\n", genOpts.songIndexFile.c_str());
 	mediaInfo._playState = 0x00;
 	
 #ifdef _WIN32
 	retVal = CPConv_Init(&cpcU8_Wide, "UTF-8", "UTF-16LE");
-#if ! HAVE_FILELOADER_W
-	{
-		std::string cpName(0x10, '\0');
-		snprintf(&cpName[0], cpName.size(), "CP%u", GetACP());
-		retVal = CPConv_Init(&cpcU8_ACP, "UTF-8", cpName.c_str());
-	}
-#endif
 #endif
 	
 	// I'll keep the instances of the players for the program's life time.
@@ -191,7 +355,7 @@ UINT8 PlayerMain(UINT8 showFileName)
 	myPlayer.RegisterPlayerEngine(new S98Player);
 	myPlayer.RegisterPlayerEngine(new DROPlayer);
 	myPlayer.SetEventCallback(FilePlayCallback, NULL);
-	myPlayer.SetFileReqCallback(PlayerFileReqCallback, NULL);
+	myPlayer.SetFileReqCallback(PlayerFileReqCallback, &mediaInfo._songPath);	// for files inside archives
 	ApplyCfg_General(myPlayer, genOpts);
 	for (size_t curChp = 0; curChp < 0x100; curChp ++)
 	{
@@ -204,9 +368,12 @@ UINT8 PlayerMain(UINT8 showFileName)
 	
 	mediaInfo._enableAlbumImage = false;	// disable by default, MediaCtrl objects will enable it on demand
 	//mediaInfo.AddSignalCallback(SignalCB, NULL);
+	InitMainLoopWait();
+	mediaInfo.SetEventCallback(MediaEventCB, NULL);
 	mediaCtrl.Init(mediaInfo);
 	
 #ifndef _WIN32
+	setvbuf(stdin, NULL, _IONBF, 0);	// don't let stdio buffer key presses where poll() can't see them
 	changemode(1);
 #endif
 	//resVal = 0;
@@ -256,6 +423,7 @@ UINT8 PlayerMain(UINT8 showFileName)
 		}
 		fflush(stdout);
 		
+		dLoad = FinishPreload(curSong);	// only swaps pointers when the file was already loaded in the background
 		retVal = OpenFile(sfl.fileName, dLoad, player);
 		if (retVal & 0x80)
 		{
@@ -291,14 +459,22 @@ UINT8 PlayerMain(UINT8 showFileName)
 		if (genOpts.setTermTitle)
 			ShowConsoleTitle();
 		ShowSongInfo();
+		UpdateSongIndex(sfl.fileName);
+		PrepareCachedPCM(dLoad);
 		
 		retVal = StartDiskWriter(sfl.fileName);
 		if (retVal)
 			fprintf(stderr, "Warning: File writer failed with error 0x%02X\n", retVal);
 		
 		mediaInfo.Signal(MI_SIG_NEW_SONG);
+		if (genOpts.preloadNext && curSong + 1 < songList.size())
+			StartPreload(curSong + 1);
+		StartPrefetch(curSong, (controlVal < 0) ? -1 : +1);	// follow the direction the user is going
 		PlayFile();
 		StopDiskWriter();
+		FinishCachedPCM();
+		if (adaptBufCnt)
+			AdaptAudioBuffers();
 		
 		mediaInfo._playState &= ~PLAYSTATE_PLAY;
 		myPlayer.Stop();
@@ -310,22 +486,28 @@ UINT8 PlayerMain(UINT8 showFileName)
 		if (! AdvanceSongList(curSong, controlVal))
 			break;
 	}	// end for(curSong)
+	FinishPreload((size_t)-1);	// discard the file that was preloaded for a song we won't play anymore
+	StopPrefetch();
 #ifndef _WIN32
 	changemode(0);
 #endif
 	mediaCtrl.Deinit();
+	mediaInfo.SetEventCallback(NULL, NULL);
+	DeinitMainLoopWait();
 	
 	myPlayer.UnregisterAllPlayers();
 	
+	songIndex.Close();
+	FinishCacheWrite();
+	Loaders_Deinit();
 #ifdef _WIN32
 	CPConv_Deinit(cpcU8_Wide);
-#if ! HAVE_FILELOADER_W
-	CPConv_Deinit(cpcU8_ACP);
-#endif
 #endif
 	
 	StopAudioDevice();
 	DeinitAudioSystem();
+	if (genOpts.showPlayStats)
+		PrintPlaybackStats();
 	
 	return 0;
 }
@@ -347,36 +529,7 @@ static bool AdvanceSongList(size_t& songIdx, int controlVal)
 	return true;
 }
 
-static DATA_LOADER* GetFileLoaderUTF8(const std::string& fileNameU8)
-{
-#ifndef _WIN32
-	return FileLoader_Init(fileNameU8.c_str());
-#else
-#if HAVE_FILELOADER_W
-	size_t fileNameWLen = 0;
-	wchar_t* fileNameWStr = NULL;
-	UINT8 retVal = CPConv_StrConvert(cpcU8_Wide, &fileNameWLen, reinterpret_cast<char**>(&fileNameWStr),
-		fileNameU8.length() + 1, fileNameU8.c_str());	// length()+1 to include the \0
-	DATA_LOADER* dLoad = NULL;
-	if (retVal < 0x80)
-		dLoad = FileLoader_InitW(fileNameWStr);
-	free(fileNameWStr);
-	return dLoad;
-#else
-	size_t fileNameALen = 0;
-	char* fileNameAStr = NULL;
-	UINT8 retVal = CPConv_StrConvert(cpcU8_ACP, &fileNameALen, &fileNameAStr,
-		fileNameU8.length() + 1, fileNameU8.c_str());	// length()+1 to include the \0
-	DATA_LOADER* dLoad = NULL;
-	if (retVal < 0x80)
-		dLoad = FileLoader_Init(fileNameAStr);
-	free(fileNameAStr);
-	return dLoad;
-#endif
-#endif
-}
-
-static UINT8 OpenFile(const std::string& fileName, DATA_LOADER*& dLoad, PlayerBase*& player)
+static UINT8 LoadFileData(const std::string& fileName, DATA_LOADER*& dLoad)
 {
 	UINT8 retVal;
 	
@@ -388,9 +541,25 @@ static UINT8 OpenFile(const std::string& fileName, DATA_LOADER*& dLoad, PlayerBa
 	if (retVal)
 	{
 		DataLoader_CancelLoading(dLoad);
-		DataLoader_Deinit(dLoad);
-		fprintf(stderr, "Error 0x%02X opening file!\n", retVal);
-		return 0xFF;
+		DataLoader_Deinit(dLoad);	dLoad = NULL;
+		return retVal;
+	}
+	return 0x00;
+}
+
+// dLoad: loader of a preloaded file or NULL in order to load the file now
+static UINT8 OpenFile(const std::string& fileName, DATA_LOADER*& dLoad, PlayerBase*& player)
+{
+	UINT8 retVal;
+	
+	if (dLoad == NULL)
+	{
+		retVal = LoadFileData(fileName, dLoad);
+		if (retVal)
+		{
+			fprintf(stderr, "Error 0x%02X opening file!\n", retVal);
+			return 0xFF;
+		}
 	}
 	retVal = mediaInfo._player.LoadFile(dLoad);
 	if (retVal)
@@ -403,6 +572,116 @@ static UINT8 OpenFile(const std::string& fileName, DATA_LOADER*& dLoad, PlayerBa
 	return 0x00;
 }
 
+static void PreloadThread(void* args)
+{
+	// Errors aren't reported here, as they would mess up the status line.
+	// A song that failed to preload is loaded again when its turn comes and that reports the error.
+	LoadFileData(songList[preloadSongIdx].fileName, preloadDLoad);
+	return;
+}
+
+// Load a song in the background, so that the track change doesn't have to wait for disk I/O and decompression.
+static void StartPreload(size_t songIdx)
+{
+	UINT8 retVal;
+	
+	FinishPreload((size_t)-1);	// discard a previous request
+	preloadSongIdx = songIdx;
+	preloadDLoad = NULL;
+	retVal = OSThread_Init(&preloadThread, PreloadThread, NULL);
+	if (retVal)
+	{
+		preloadThread = NULL;	// the song will be loaded when it is played
+		preloadSongIdx = (size_t)-1;
+	}
+	return;
+}
+
+// Wait for the preloading thread and return its loader if it belongs to song "songIdx".
+// Returns NULL when the song wasn't preloaded. Data preloaded for other songs is discarded.
+static DATA_LOADER* FinishPreload(size_t songIdx)
+{
+	DATA_LOADER* dLoad;
+	
+	if (preloadThread == NULL)
+		return NULL;
+	OSThread_Join(preloadThread);
+	OSThread_Deinit(preloadThread);	preloadThread = NULL;
+	
+	dLoad = preloadDLoad;
+	preloadDLoad = NULL;
+	if (dLoad != NULL && preloadSongIdx != songIdx)
+	{
+		DataLoader_Deinit(dLoad);
+		dLoad = NULL;
+	}
+	preloadSongIdx = (size_t)-1;
+	return dLoad;
+}
+
+static void PrefetchThread(void* args)
+{
+	UINT64 maxBytes = (UINT64)mediaInfo._genOpts.prefetchSize << 20;
+	UINT64 usedBytes = 0;
+	
+	for (size_t curFile = 0; curFile < prefetchFiles.size(); curFile ++)
+	{
+		if (prefetchStop || usedBytes >= maxBytes)
+			break;
+		usedBytes += Loaders_PrefetchFile(prefetchFiles[curFile], maxBytes - usedBytes, &prefetchStop);
+	}
+	return;
+}
+
+// Get the files of the next PrefetchSongs songs (in playback direction) into the OS file cache,
+// so that track changes don't wait for slow storage.
+static void StartPrefetch(size_t songIdx, int direction)
+{
+	const GeneralOptions& genOpts = mediaInfo._genOpts;
+	UINT8 retVal;
+	
+	StopPrefetch();
+	if (! genOpts.prefetchSongs || ! genOpts.prefetchSize)
+		return;
+	
+	prefetchFiles.clear();
+	for (UINT32 curSng = 0; curSng < genOpts.prefetchSongs; curSng ++)
+	{
+		if (direction < 0)
+		{
+			if (songIdx == 0)
+				break;
+			songIdx --;
+		}
+		else
+		{
+			if (songIdx + 1 >= songList.size())
+				break;
+			songIdx ++;
+		}
+		prefetchFiles.push_back(songList[songIdx].fileName);
+	}
+	if (prefetchFiles.empty())
+		return;
+	
+	prefetchStop = false;
+	retVal = OSThread_Init(&prefetchThread, PrefetchThread, NULL);
+	if (retVal)
+		prefetchThread = NULL;	// not important enough for an error message
+	return;
+}
+
+static void StopPrefetch(void)
+{
+	if (prefetchThread == NULL)
+		return;
+	
+	prefetchStop = true;
+	OSThread_Join(prefetchThread);
+	OSThread_Deinit(prefetchThread);	prefetchThread = NULL;
+	return;
+}
+
 static void PreparePlayback(void)
 {
 	PlayerA& myPlayer = mediaInfo._player;
@@ -539,12 +818,64 @@ static UINT8 PlayFile(void)
 	PlayerA& myPlayer = mediaInfo._player;
 	UINT8 retVal;
 	bool needRefresh;
-	
+	bool rawFadeSent;
+	UINT32 lastPosChgCnt;
+	UINT32 loadUSecStart, loadSmplStart;	// render load counters at the start of the song
+	UINT32 loadUSecLast, loadSmplLast;		// ... at the last measurement
+	double loadCur, loadPeak;
+	
+	renderCmdQueue.Clear();	// drop commands that were meant for the previous song
+	lastPosChgCnt = renderPosChgCnt;
+	loadUSecStart = loadUSecLast = renderLoadUSec;
+	loadSmplStart = loadSmplLast = renderLoadSmpls;
+	loadCur = loadPeak = 0.0;
+	statLastBufTime = 0.0;	// don't count the time between songs as a late callback
+	rawFadeSent = false;
+	renderAhead = false;
 	if (adOut.data != NULL)
-		retVal = AudioDrv_SetCallback(adOut.data, FillBuffer, &myPlayer);
+	{
+		if (renderAheadBytes > 0 && ! StartRenderThread())
+		{
+			renderAhead = true;
+			retVal = AudioDrv_SetCallback(adOut.data, FillBufferAhead, &myPlayer);
+			if (retVal != AERR_OK)
+			{
+				StopRenderThread();
+				renderAhead = false;
+			}
+		}
+		else
+		{
+			retVal = AudioDrv_SetCallback(adOut.data, FillBuffer, &myPlayer);
+		}
+	}
 	else
+	{
 		retVal = 0xFF;
+	}
 	manualRenderLoop = (retVal != AERR_OK);
+	if (manualRenderLoop && ! mainThreadOptsDone)
+	{
+		mainThreadOptsDone = true;
+		ApplyRenderThreadOpts("main thread");
+	}
+	if (genOpts.lockMemory)
+	{
+		// Done for every song, because the sound chips allocate their memory when the song starts.
+		// Memory that is mapped, but not in RAM yet (e.g. the rest of a mapped song file), is locked when it is used.
+		// The cache capture buffers are only written sequentially and aren't worth locking.
+		int lockErr = LockProcessMemory();
+		UnlockMemory(cacheCapBuf, cacheCapBufSize);
+		UnlockMemory(cacheWriteBuf, cacheWriteSize);
+		if (lockErr && ! memLockWarnShown)
+		{
+			memLockWarnShown = true;
+			if (lockErr == EPERM)
+				fprintf(stderr, "Warning: No permission to lock the memory! (RLIMIT_MEMLOCK is too low)\n");
+			else
+				fprintf(stderr, "Warning: Unable to lock the memory: %s\n", strerror(lockErr));
+		}
+	}
 	controlVal = 0;
 	mediaInfo._playState &= ~PLAYSTATE_END;
 	needRefresh = true;
@@ -568,11 +899,46 @@ static UINT8 PlayFile(void)
 			UINT32 dataLen = mediaInfo._fileEndPos - mediaInfo._fileStartPos;
 			UINT32 dataPos = myPlayer.GetCurPos(PLAYPOS_FILEOFS);
 			dataPos = (dataPos >= mediaInfo._fileStartPos) ? (dataPos - mediaInfo._fileStartPos) : 0x00;
+			double curTime;
+			if (cachePlay)
+			{
+				curTime = GetCachedPCMTime(myPlayer);
+				dataPos = (UINT32)((UINT64)dataLen * cachePos / cachePCM.size());	// estimate, the file isn't processed
+			}
+			else
+			{
+				curTime = myPlayer.GetCurTime(0);
+			}
+			if (renderAhead)
+			{
+				// show the time of what is audible, not of what was rendered last
+				curTime -= (double)pcmRing.GetReadAvail() / pcmSmplSize / myPlayer.GetSampleRate();
+				if (curTime < 0.0)
+					curTime = 0.0;
+			}
 			
-			printf("%s%6.2f%%  %s / %s seconds  \r", pState,
+			printf("%s%6.2f%%  %s / %s seconds  ", pState,
 					100.0 * dataPos / dataLen,
-					GetTimeStr(myPlayer.GetCurTime(0), timeDispMode).c_str(),
+					GetTimeStr(curTime, timeDispMode).c_str(),
 					GetTimeStr(myPlayer.GetTotalTime(0), timeDispMode).c_str());
+			if (genOpts.showRenderLoad)
+			{
+				UINT32 smplCnt = AtomicLoadAcq(&renderLoadSmpls) - loadSmplLast;
+				// average over at least 1/10 second, single buffers are too noisy
+				if (smplCnt >= myPlayer.GetSampleRate() / 10)
+				{
+					UINT32 usecCnt = renderLoadUSec - loadUSecLast;
+					loadSmplLast += smplCnt;
+					loadUSecLast += usecCnt;
+					loadCur = 100.0 * usecCnt / 1000000.0 / ((double)smplCnt / myPlayer.GetSampleRate());
+					if (loadPeak < loadCur)
+						loadPeak = loadCur;
+				}
+				printf("CPU%6.1f%%  ", loadCur);
+			}
+			if (genOpts.showPlayStats >= 2)
+				printf("Miss %u  Late %u  ", statMissCnt + statUnderrunCnt, statLateCnt);
+			printf("\r");
 			fflush(stdout);
 			needRefresh = false;
 		}
@@ -587,7 +953,11 @@ static UINT8 PlayFile(void)
 		}
 		else
 		{
-			Sleep(50);
+			if (manualRenderLoop)
+				ApplyRenderCmds(myPlayer);	// we are the render thread, so apply seeking while paused
+			// Sleep until a key is pressed, a control event arrives or the song ends.
+			// While playing, we also need to wake up regularly in order to update the status line.
+			WaitForMainLoopEvent((mediaInfo._playState & PLAYSTATE_PAUSE) ? (UINT32)-1 : 50);
 		}
 		
 		mediaCtrl.ReadWriteDispatch();
@@ -605,17 +975,22 @@ static UINT8 PlayFile(void)
 			if (retVal >= 0x10)
 				break;
 		}
+		if (AtomicLoadAcq(&renderPosChgCnt) != lastPosChgCnt)
+		{
+			// the render thread finished seeking/restarting
+			lastPosChgCnt = renderPosChgCnt;
+			rawFadeSent = false;
+			needRefresh = true;
+			mediaInfo.Signal(MI_SIG_POSITION);
+		}
 		
-		if (genOpts.fadeRawLogs && mediaInfo._isRawLog && genOpts.fadeTime_single > 0)
+		if (genOpts.fadeRawLogs && mediaInfo._isRawLog && genOpts.fadeTime_single > 0 && ! rawFadeSent)
 		{
 			if (! (mediaInfo._playState & PLAYSTATE_PAUSE) && ! (myPlayer.GetState() & PLAYSTATE_FADE))
 			{
 				double fadeStart = myPlayer.GetTotalTime(1) - genOpts.fadeTime_single / 1500.0;
 				if (myPlayer.GetCurTime(1) >= fadeStart)
-				{
-					myPlayer.SetFadeSamples(MSec2Samples(genOpts.fadeTime_single, myPlayer));
-					myPlayer.FadeOut();	// (FadeTime / 1500) ends at 33%
-				}
+					rawFadeSent = PushRenderCmd(MI_EVT_FADE, genOpts.fadeTime_single);	// (FadeTime / 1500) ends at 33%
 			}
 		}
 	}
@@ -628,6 +1003,11 @@ static UINT8 PlayFile(void)
 		else
 			AudioDrv_SetCallback(adOut.data, NULL, NULL);
 	}
+	if (renderAhead)
+	{
+		StopRenderThread();
+		renderAhead = false;
+	}
 	
 	if (! controlVal)
 	{
@@ -637,6 +1017,14 @@ static UINT8 PlayFile(void)
 			controlVal = +1;	// finished normally - next song
 	}
 	printf("\n");
+	if (genOpts.showRenderLoad >= 2)
+	{
+		UINT32 smplCnt = renderLoadSmpls - loadSmplStart;
+		UINT32 usecCnt = renderLoadUSec - loadUSecStart;
+		if (smplCnt > 0)
+			printf("Render Load:    %.1f %% average, %.1f %% peak of realtime\n",
+				100.0 * usecCnt / 1000000.0 / ((double)smplCnt / myPlayer.GetSampleRate()), loadPeak);
+	}
 	
 	return 0x00;
 }
@@ -644,7 +1032,6 @@ static UINT8 PlayFile(void)
 static UINT8 HandleCtrlEvent(UINT8 evtType, INT32 evtParam)
 {
 	const GeneralOptions& genOpts = mediaInfo._genOpts;
-	PlayerA& myPlayer = mediaInfo._player;
 	
 	switch(evtType)
 	{
@@ -680,11 +1067,7 @@ static UINT8 HandleCtrlEvent(UINT8 evtType, INT32 evtParam)
 		case MIE_CTRL_RESTART:	// restart
 			if (! (mediaInfo._playState & PLAYSTATE_PLAY))
 				break;
-			OSMutex_Lock(renderMtx);
-			myPlayer.Reset();
-			OSMutex_Unlock(renderMtx);
-			mediaInfo.Signal(MI_SIG_POSITION);
-			return 0x01;
+			return PushRenderCmd(MI_EVT_CONTROL, MIE_CTRL_RESTART) ? 0x01 : 0x00;
 		}
 		break;
 	case MI_EVT_PAUSE:
@@ -719,148 +1102,430 @@ static UINT8 HandleCtrlEvent(UINT8 evtType, INT32 evtParam)
 		if (! (mediaInfo._playState & PLAYSTATE_PLAY))
 			break;
 		// enforce "non-playlist" fade-out
-		OSMutex_Lock(renderMtx);
-		myPlayer.SetFadeSamples(MSec2Samples(genOpts.fadeTime_single, myPlayer));
-		myPlayer.FadeOut();
-		OSMutex_Unlock(renderMtx);
-		return 0x01;
+		return PushRenderCmd(MI_EVT_FADE, genOpts.fadeTime_single) ? 0x01 : 0x00;
 	case MI_EVT_SEEK_REL:
-		if (! (mediaInfo._playState & PLAYSTATE_PLAY))
-			break;
-		OSMutex_Lock(renderMtx);
-		{
-			UINT32 destPos = mediaInfo._player.GetCurPos(PLAYPOS_SAMPLE);
-			if (evtParam < 0 && (UINT32)-evtParam > destPos)
-				destPos = 0;
-			else
-				destPos += evtParam;
-			mediaInfo._player.Seek(PLAYPOS_SAMPLE, destPos);
-		}
-		OSMutex_Unlock(renderMtx);
-		mediaInfo.Signal(MI_SIG_POSITION);
-		return 0x01;
 	case MI_EVT_SEEK_ABS:
 		if (! (mediaInfo._playState & PLAYSTATE_PLAY))
 			break;
-		OSMutex_Lock(renderMtx);
-		mediaInfo._player.Seek(PLAYPOS_SAMPLE, (UINT32)evtParam);
-		OSMutex_Unlock(renderMtx);
-		mediaInfo.Signal(MI_SIG_POSITION);
-		return 0x01;
+		return PushRenderCmd(evtType, evtParam) ? 0x01 : 0x00;
 	case MI_EVT_SEEK_PERC:
 		if (! (mediaInfo._playState & PLAYSTATE_PLAY))
 			break;
 		if (evtParam < 0)
 			evtParam = 0;
-		{
-			UINT32 maxPos;
-			UINT32 destPos;
-			
-			OSMutex_Lock(renderMtx);
-			maxPos = myPlayer.GetPlayer()->GetTotalPlayTicks(genOpts.maxLoops);
-			destPos = maxPos * evtParam / 100;
-			myPlayer.Seek(PLAYPOS_TICK, destPos);
-			OSMutex_Unlock(renderMtx);
-			mediaInfo.Signal(MI_SIG_POSITION);
-		}
-		return 0x01;
+		return PushRenderCmd(evtType, evtParam) ? 0x01 : 0x00;
 	}
 	
 	return 0x00;
 }
 
-
-#ifdef WIN32
-static int GetPressedKey(void)
+// Commands that modify the player state are never executed by the control thread.
+// They are queued and the render thread applies them before rendering the next buffer,
+// so the audio callback doesn't have to wait for the UI.
+static bool PushRenderCmd(UINT8 type, INT32 param)
 {
-	int keyCode = _getch();
-	switch(keyCode)
+	RenderCmd rc;
+	rc.type = type;
+	rc.param = param;
+	if (! renderCmdQueue.Write(&rc, 1))
 	{
-	case 0xE0:	// Special Key #1
-		// Windows cursor key codes
-		// Shift + Cursor results in the same code as if Shift wasn't pressed
-		//	Key     None    Ctrl    Alt
-		//	Up      E0 48   E0 8D   00 98
-		//	Down    E0 50   E0 91   00 A0
-		//	Left    E0 4B   E0 73   00 9B
-		//	Right   E0 4D   E0 74   00 9D
-		keyCode = _getch();	// Get 2nd Key
-		switch(keyCode)
-		{
-		case 0x48:
-			return KEY_UP;
-		case 0x49:
-			return KEY_PPAGE;
-		case 0x4B:
-			return KEY_LEFT;
-		case 0x4D:
-			return KEY_RIGHT;
-		case 0x50:
-			return KEY_DOWN;
-		case 0x51:
-			return KEY_NPAGE;
-		case 0x73:
-			return KEY_CTRL | KEY_LEFT;
-		case 0x74:
-			return KEY_CTRL | KEY_RIGHT;
-		case 0x8D:
-			return KEY_CTRL | KEY_UP;
-		case 0x91:
-			return KEY_CTRL | KEY_DOWN;
-		}
-		break;
-	case 0x00:	// Special Key #2
-		keyCode = _getch();	// Get 2nd Key
-		switch(keyCode)
-		{
-		case 0x98:
-			return KEY_ALT | KEY_UP;
-		case 0x9B:
-			return KEY_ALT | KEY_LEFT;
-		case 0x9D:
-			return KEY_ALT | KEY_RIGHT;
-		case 0xA0:
-			return KEY_ALT | KEY_DOWN;
-		}
-		break;
+		statCmdDropCnt ++;
+		return false;
 	}
-	return keyCode;
+	if (renderAhead)
+		OSSignal_Signal(renderWakeSig);
+	return true;
 }
-#else
-static int GetPressedKey(void)
+
+// must be called from the render thread only
+static void ApplyRenderCmds(PlayerA& player)
 {
-	int keyCode = _getch();
-	if (keyCode != 0x1B)
-		return keyCode;
-	
-	int keyModifers = 0x00;
+	const GeneralOptions& genOpts = mediaInfo._genOpts;
+	RenderCmd rc;
+	bool posChange = false;
 	
-	// handle escape codes
-	keyCode = _getch();
-	if (keyCode == 0x1B || keyCode == 0x00)
-		return 0x1B;	// ESC Key pressed
-	switch(keyCode)
+	while(renderCmdQueue.Read(&rc, 1))
 	{
-	case 0x5B:
-		// cursor only:     1B 41..44
-		// Shift + cursor:  1B 31 3B 32 41..44
-		// Alt + cursor:    1B 31 3B 33 41..44
-		// Ctrl + cursor:   1B 31 3B 35 41..44
-		// page down/up:    1B 35/36 7E
-		keyCode = _getch();	// get 2nd Key
-		if (keyCode == 0x31)	// Ctrl or Alt key
+		switch(rc.type)
 		{
-			keyCode = _getch();
-			if (keyCode == 0x3B)
+		case MI_EVT_CONTROL:	// MIE_CTRL_RESTART
+			if (cachePlay)
 			{
-				keyCode = _getch();
-				if ((keyCode - 0x31) & 0x01)
-					keyModifers |= KEY_SHIFT;
-				if ((keyCode - 0x31) & 0x02)
-					keyModifers |= KEY_ALT;
-				if ((keyCode - 0x31) & 0x04)
-					keyModifers |= KEY_CTRL;
-				keyCode = _getch();
+				cachePos = 0;
+			}
+			else
+			{
+				player.Reset();
+				cacheCapSize = 0;	// capture the song again from the beginning
+			}
+			DiscardRenderedPCM();
+			posChange = true;
+			break;
+		case MI_EVT_FADE:	// param: fade time in ms
+			if (cachePlay)
+				LeaveCachedPCM(player);	// the fade-out isn't part of the cached audio
+			cacheCapture = false;
+			player.SetFadeSamples(MSec2Samples((UINT32)rc.param, player));
+			player.FadeOut();
+			break;
+		case MI_EVT_SEEK_REL:
+			{
+				UINT32 destPos = GetPlaybackSample(player);
+				if (rc.param < 0 && (UINT32)-rc.param > destPos)
+					destPos = 0;
+				else
+					destPos += rc.param;
+				if (! SeekRenderedPCM(player, destPos))
+				{
+					SeekRenderPos(player, PLAYPOS_SAMPLE, destPos);
+					DiscardRenderedPCM();
+				}
+			}
+			posChange = true;
+			break;
+		case MI_EVT_SEEK_ABS:
+			if (! SeekRenderedPCM(player, (UINT32)rc.param))
+			{
+				SeekRenderPos(player, PLAYPOS_SAMPLE, (UINT32)rc.param);
+				DiscardRenderedPCM();
+			}
+			posChange = true;
+			break;
+		case MI_EVT_SEEK_PERC:
+			{
+				UINT32 maxPos = player.GetPlayer()->GetTotalPlayTicks(genOpts.maxLoops);
+				UINT32 destPos = maxPos * rc.param / 100;
+				if (! SeekRenderedPCM(player, player.GetPlayer()->Tick2Sample(destPos)))
+				{
+					SeekRenderPos(player, PLAYPOS_TICK, destPos);
+					DiscardRenderedPCM();
+				}
+			}
+			posChange = true;
+			break;
+		}
+	}
+	if (posChange)
+	{
+		AtomicStoreRel(&renderPosChgCnt, renderPosChgCnt + 1);	// the main thread sends MI_SIG_POSITION
+		WakeMainLoop();
+	}
+	
+	return;
+}
+
+// render thread: get the sample that is played next
+// In render-ahead mode, the player is ahead of the audio device by the contents of the PCM ring.
+static UINT32 GetPlaybackSample(PlayerA& player)
+{
+	UINT32 smplPos = GetRenderSample(player);
+	if (! renderAhead)
+		return smplPos;
+	
+	UINT32 readPos = pcmSeekValid ? pcmSeekPos : pcmRing.GetReadPos();
+	UINT32 queuedSmpls = (pcmRing.GetWritePos() - readPos) / pcmSmplSize;
+	return (smplPos > queuedSmpls) ? (smplPos - queuedSmpls) : 0;
+}
+
+// render thread: Seek by moving the read position of the audio callback within the audio that was
+// already rendered. This makes seeking back instant, as the player doesn't need to restart the song.
+// Returns false when the position isn't buffered.
+static bool SeekRenderedPCM(PlayerA& player, UINT32 smplPos)
+{
+	if (! renderAhead)
+		return false;
+	
+	UINT32 renderSmpl = GetRenderSample(player);
+	UINT32 writePos = pcmRing.GetWritePos();
+	UINT32 readPos = pcmRing.GetReadPos();
+	if (smplPos > renderSmpl)
+		return false;	// not rendered yet
+	if (renderSmpl - smplPos > (writePos - pcmHistStart) / pcmSmplSize)
+		return false;	// before the start of the buffered audio
+	
+	UINT32 seekPos = writePos - (renderSmpl - smplPos) * pcmSmplSize;
+	if ((INT32)(readPos - seekPos) > (INT32)pcmHistBytes)
+		return false;	// too old, the render thread may overwrite it already
+	
+	pcmSeekPos = seekPos;
+	pcmSeekValid = true;
+	return true;
+}
+
+// render thread: drop all buffered audio after the player changed its position
+static void DiscardRenderedPCM(void)
+{
+	if (! renderAhead)
+		return;
+	
+	pcmSeekPos = pcmRing.GetWritePos();
+	pcmSeekValid = true;
+	pcmHistStart = pcmSeekPos;
+	AtomicStoreRel(&renderEnd, false);
+	return;
+}
+
+// main thread: look up the song in the cache or prepare capturing its audio
+static void PrepareCachedPCM(DATA_LOADER* dLoad)
+{
+	const GeneralOptions& genOpts = mediaInfo._genOpts;
+	UINT32 fadeMS;
+	UINT8 retVal;
+	
+	cachePlay = false;
+	cacheCapture = false;
+	cachePos = 0;
+	if (! pcmCache.IsEnabled())
+		return;
+	
+	// same choice as in PreparePlayback()
+	fadeMS = (curSong + 1 == songList.size()) ? genOpts.fadeTime_single : genOpts.fadeTime_plist;
+	DataLoader_ReadAll(dLoad);
+	cacheKey = PCMCache::GetKey(DataLoader_GetData(dLoad), DataLoader_GetSize(dLoad), genOpts, fadeMS,
+		0x100, mediaInfo._chipOpts);
+	retVal = pcmCache.Load(cacheKey, pcmSmplSize, cachePCM);
+	if (! retVal && ! cachePCM.empty())
+	{
+		cachePlay = true;
+		printf("Playing from the cache.\n");
+		return;
+	}
+	
+	// The capture buffer is allocated here, as the render thread must not allocate memory.
+	// Capturing stops when the song gets longer than expected.
+	PlayerA& myPlayer = mediaInfo._player;
+	UINT32 pauseMS = (genOpts.pauseTime_loop > genOpts.pauseTime_jingle) ? genOpts.pauseTime_loop : genOpts.pauseTime_jingle;
+	double songTime = myPlayer.GetTotalTime(1) + (fadeMS + pauseMS) / 1000.0;
+	double songBytes = (songTime * 1.0625 + 1.0) * myPlayer.GetSampleRate() * pcmSmplSize;
+	cachePCM.clear();
+	if (songTime <= 0.0 || songBytes > cacheCaptureMax)
+		return;	// unknown length or too large
+	cacheCapBufSize = (size_t)songBytes;
+	cacheCapBuf = (UINT8*)malloc(cacheCapBufSize);
+	if (cacheCapBuf == NULL)
+		return;
+	cacheCapSize = 0;
+	cacheCapture = true;
+	return;
+}
+
+// main thread, after playback stopped: store songs that were rendered completely
+static void FinishCachedPCM(void)
+{
+	// The song is handed to the writer thread, so that the next song can start right away.
+	// When the writer is still busy with the previous song, this one isn't cached.
+	if (cacheCapture && (mediaInfo._player.GetState() & PLAYSTATE_END) &&
+		(cacheWriteThread == NULL || AtomicLoadAcq(&cacheWriteDone)))
+	{
+		UINT8 retVal;
+		
+		FinishCacheWrite();
+		cacheWriteKey = cacheKey;
+		cacheWriteBuf = cacheCapBuf;
+		cacheWriteSize = cacheCapSize;
+		cacheWriteDone = false;
+		retVal = OSThread_Init(&cacheWriteThread, CacheWriteThread, NULL);
+		if (retVal)
+		{
+			cacheWriteThread = NULL;
+			cacheWriteBuf = NULL;
+		}
+		else
+		{
+			cacheCapBuf = NULL;	// owned by the writer now
+		}
+	}
+	cachePlay = false;
+	cacheCapture = false;
+	free(cacheCapBuf);	cacheCapBuf = NULL;
+	cacheCapBufSize = 0;
+	std::vector<UINT8>().swap(cachePCM);	// free the memory
+	return;
+}
+
+static void CacheWriteThread(void* args)
+{
+	// Errors are reported by FinishCacheWrite(), as they would mess up the status line.
+	cacheWriteRes = pcmCache.Store(cacheWriteKey, pcmSmplSize, cacheWriteBuf, cacheWriteSize);
+	AtomicStoreRel(&cacheWriteDone, true);
+	return;
+}
+
+// main thread: wait for the cache writer and free its buffer
+static void FinishCacheWrite(void)
+{
+	if (cacheWriteThread == NULL)
+		return;
+	OSThread_Join(cacheWriteThread);
+	OSThread_Deinit(cacheWriteThread);	cacheWriteThread = NULL;
+	
+	free(cacheWriteBuf);	cacheWriteBuf = NULL;
+	if (cacheWriteRes)
+		fprintf(stderr, "Warning: Unable to write the song into the cache! (Error 0x%02X)\n", cacheWriteRes);
+	return;
+}
+
+// main thread, after the song was started: add new or modified songs to the index
+static void UpdateSongIndex(const std::string& fileName)
+{
+	SongIndexEntry entry;
+	UINT64 mtime;
+	UINT64 fileSize;
+	
+	if (! songIndex.IsEnabled())
+		return;
+	if (! GetFileStampU8(fileName, mtime, fileSize))
+		return;	// files inside archives aren't indexed
+	if (! songIndex.Lookup(fileName, fileSize, mtime, entry))
+		return;	// up to date
+	SongIndex::MakeEntry(mediaInfo, entry);
+	songIndex.Store(fileName, fileSize, mtime, entry);
+	return;
+}
+
+// render thread: sample position of the next rendered sample
+static UINT32 GetRenderSample(PlayerA& player)
+{
+	if (cachePlay)
+		return cachePos / pcmSmplSize;
+	return player.GetCurPos(PLAYPOS_SAMPLE);
+}
+
+// render thread: set the position of the player or of the cached audio
+static void SeekRenderPos(PlayerA& player, UINT8 posType, UINT32 pos)
+{
+	if (cachePlay)
+	{
+		UINT32 smplPos = (posType == PLAYPOS_TICK) ? player.GetPlayer()->Tick2Sample(pos) : pos;
+		UINT64 bytePos = (UINT64)smplPos * pcmSmplSize;
+		cachePos = (bytePos < cachePCM.size()) ? (UINT32)bytePos : (UINT32)cachePCM.size();
+		return;
+	}
+	
+	player.Seek(posType, pos);
+	cacheCapture = false;	// the audio has a gap now
+	return;
+}
+
+// render thread: continue with emulating the song at the current position of the cached audio
+static void LeaveCachedPCM(PlayerA& player)
+{
+	player.Seek(PLAYPOS_SAMPLE, cachePos / pcmSmplSize);
+	cachePlay = false;
+	return;
+}
+
+static bool IsRenderEnd(PlayerA& player)
+{
+	if (cachePlay)
+		return (cachePos >= cachePCM.size());
+	return (player.GetState() & PLAYSTATE_END) != 0;
+}
+
+// main thread: time of the cached audio, wrapped into the loop like PlayerA::GetCurTime(0)
+static double GetCachedPCMTime(PlayerA& player)
+{
+	double curTime = (double)(cachePos / pcmSmplSize) / player.GetSampleRate();
+	double songTime = player.GetTotalTime(0);
+	double loopTime = player.GetLoopTime();
+	
+	if (loopTime > 0.0 && curTime > songTime)
+		curTime = songTime - loopTime + fmod(curTime - (songTime - loopTime), loopTime);
+	return curTime;
+}
+
+
+#ifdef WIN32
+static int GetPressedKey(void)
+{
+	int keyCode = _getch();
+	switch(keyCode)
+	{
+	case 0xE0:	// Special Key #1
+		// Windows cursor key codes
+		// Shift + Cursor results in the same code as if Shift wasn't pressed
+		//	Key     None    Ctrl    Alt
+		//	Up      E0 48   E0 8D   00 98
+		//	Down    E0 50   E0 91   00 A0
+		//	Left    E0 4B   E0 73   00 9B
+		//	Right   E0 4D   E0 74   00 9D
+		keyCode = _getch();	// Get 2nd Key
+		switch(keyCode)
+		{
+		case 0x48:
+			return KEY_UP;
+		case 0x49:
+			return KEY_PPAGE;
+		case 0x4B:
+			return KEY_LEFT;
+		case 0x4D:
+			return KEY_RIGHT;
+		case 0x50:
+			return KEY_DOWN;
+		case 0x51:
+			return KEY_NPAGE;
+		case 0x73:
+			return KEY_CTRL | KEY_LEFT;
+		case 0x74:
+			return KEY_CTRL | KEY_RIGHT;
+		case 0x8D:
+			return KEY_CTRL | KEY_UP;
+		case 0x91:
+			return KEY_CTRL | KEY_DOWN;
+		}
+		break;
+	case 0x00:	// Special Key #2
+		keyCode = _getch();	// Get 2nd Key
+		switch(keyCode)
+		{
+		case 0x98:
+			return KEY_ALT | KEY_UP;
+		case 0x9B:
+			return KEY_ALT | KEY_LEFT;
+		case 0x9D:
+			return KEY_ALT | KEY_RIGHT;
+		case 0xA0:
+			return KEY_ALT | KEY_DOWN;
+		}
+		break;
+	}
+	return keyCode;
+}
+#else
+static int GetPressedKey(void)
+{
+	int keyCode = _getch();
+	if (keyCode != 0x1B)
+		return keyCode;
+	
+	int keyModifers = 0x00;
+	
+	// handle escape codes
+	keyCode = _getch();
+	if (keyCode == 0x1B || keyCode == 0x00)
+		return 0x1B;	// ESC Key pressed
+	switch(keyCode)
+	{
+	case 0x5B:
+		// cursor only:     1B 41..44
+		// Shift + cursor:  1B 31 3B 32 41..44
+		// Alt + cursor:    1B 31 3B 33 41..44
+		// Ctrl + cursor:   1B 31 3B 35 41..44
+		// page down/up:    1B 35/36 7E
+		keyCode = _getch();	// get 2nd Key
+		if (keyCode == 0x31)	// Ctrl or Alt key
+		{
+			keyCode = _getch();
+			if (keyCode == 0x3B)
+			{
+				keyCode = _getch();
+				if ((keyCode - 0x31) & 0x01)
+					keyModifers |= KEY_SHIFT;
+				if ((keyCode - 0x31) & 0x02)
+					keyModifers |= KEY_ALT;
+				if ((keyCode - 0x31) & 0x04)
+					keyModifers |= KEY_CTRL;
+				keyCode = _getch();
 			}
 		}
 		switch(keyCode)
@@ -986,9 +1651,136 @@ static std::string GetTimeStr(double seconds, INT8 showHours)
 	return std::string(timeStr);
 }
 
+// render thread: PlayerA::Render plus time measurement for the render load display
+static UINT32 RenderMeasured(PlayerA& player, UINT32 bufSize, void* data)
+{
+	if (! mediaInfo._genOpts.showRenderLoad && ! statsEnable)
+		return player.Render(bufSize, data);
+	
+	double startTime = GetMonotonicTime();
+	UINT32 renderedBytes = player.Render(bufSize, data);
+	UINT32 usecCnt = (UINT32)((GetMonotonicTime() - startTime) * 1000000.0 + 0.5);
+	UINT32 smplCnt = renderedBytes / pcmSmplSize;
+	AtomicStoreRel(&renderLoadUSec, renderLoadUSec + usecCnt);
+	AtomicStoreRel(&renderLoadSmpls, renderLoadSmpls + smplCnt);
+	if (statsEnable && smplCnt > 0)
+	{
+		UINT32 bufUSec = (UINT32)((UINT64)smplCnt * 1000000 / player.GetSampleRate());
+		UINT32 histIdx = (UINT32)((UINT64)usecCnt * 100 / bufUSec);
+		if (histIdx >= RTIME_HIST_SIZE)
+			histIdx = RTIME_HIST_SIZE - 1;
+		statRenderHist[histIdx] ++;
+		if (statRenderMaxUSec < usecCnt)
+			statRenderMaxUSec = usecCnt;
+		// The render-ahead thread can be slow now and then, only its underruns matter.
+		if (! renderAhead && usecCnt > bufUSec)
+			AtomicStoreRel(&statMissCnt, statMissCnt + 1);	// the driver will run out of data if this continues
+	}
+	return renderedBytes;
+}
+
+// render thread: audio from the cache or the player, also collects the audio for the cache
+static UINT32 RenderAudio(PlayerA& player, UINT32 bufSize, void* data)
+{
+	if (cachePlay)
+	{
+		UINT32 pos = cachePos;
+		UINT32 readBytes = (UINT32)cachePCM.size() - pos;
+		if (readBytes > bufSize)
+			readBytes = bufSize;
+		memcpy(data, &cachePCM[0] + pos, readBytes);
+		cachePos = pos + readBytes;
+		if (renderAhead)
+			return readBytes;	// RenderAheadChunk() handles the end
+		
+		// like PlayerA::Render, fill the buffer with silence after the end
+		memset((UINT8*)data + readBytes, 0x00, bufSize - readBytes);
+		if (cachePos >= cachePCM.size())
+		{
+			mediaInfo._playState |= PLAYSTATE_END;
+			WakeMainLoop();
+		}
+		return bufSize;
+	}
+	
+	UINT32 renderedBytes = RenderMeasured(player, bufSize, data);
+	if (cacheCapture)
+	{
+		if (renderedBytes > cacheCapBufSize - cacheCapSize)
+		{
+			cacheCapture = false;	// too large
+		}
+		else
+		{
+			memcpy(&cacheCapBuf[cacheCapSize], data, renderedBytes);
+			cacheCapSize += renderedBytes;
+		}
+	}
+	return renderedBytes;
+}
+
+// called for every buffer that is passed to the audio driver
+static void CountAudioBuffer(UINT32 bufSize)
+{
+	if (! statsEnable)
+		return;
+	
+	double curTime = GetMonotonicTime();
+	double bufDist = curTime - statLastBufTime;
+	// longer gaps are pauses or song changes
+	if (bufDist > statLastBufLen * 1.5 && bufDist < 1.0)
+		AtomicStoreRel(&statLateCnt, statLateCnt + 1);
+	statLastBufTime = curTime;
+	statLastBufLen = (double)bufSize / pcmSmplSize / mediaInfo._player.GetSampleRate();
+	AtomicStoreRel(&statBufCnt, statBufCnt + 1);
+	return;
+}
+
+// returns the render time (in % of the buffer length) that "permille" of all buffers stayed below
+static UINT32 GetRenderTimePercentile(UINT32 permille)
+{
+	UINT64 totalCnt = 0;
+	UINT64 curCnt = 0;
+	UINT32 curIdx;
+	
+	for (curIdx = 0; curIdx < RTIME_HIST_SIZE; curIdx ++)
+		totalCnt += statRenderHist[curIdx];
+	for (curIdx = 0; curIdx < RTIME_HIST_SIZE; curIdx ++)
+	{
+		curCnt += statRenderHist[curIdx];
+		if (curCnt * 1000 >= totalCnt * permille)
+			break;
+	}
+	return (curIdx < RTIME_HIST_SIZE) ? curIdx : (RTIME_HIST_SIZE - 1);
+}
+
+static void PrintPlaybackStats(void)
+{
+	UINT32 histSum = 0;
+	UINT32 curIdx;
+	
+	for (curIdx = 0; curIdx < RTIME_HIST_SIZE; curIdx ++)
+		histSum += statRenderHist[curIdx];
+	printf("Playback Statistics:\n");
+	printf("    Audio buffers:          %u (%.1f ms each)\n", statBufCnt, audBufUSec / 1000.0);
+	printf("    Missed deadlines:       %u (rendering took longer than playing)\n", statMissCnt);
+	printf("    Render-ahead underruns: %u\n", statUnderrunCnt);
+	printf("    Late audio callbacks:   %u\n", statLateCnt);
+	if (histSum > 0)
+		printf("    Render time per buffer: %u %% median, %u %% 99th percentile, %.2f ms max (%% of the buffer length)\n",
+			GetRenderTimePercentile(500), GetRenderTimePercentile(990), statRenderMaxUSec / 1000.0);
+	printf("    Dropped render commands: %u\n", statCmdDropCnt);
+	return;
+}
+
 static UINT32 FillBuffer(void* drvStruct, void* userParam, UINT32 bufSize, void* data)
 {
 	PlayerA* myPlr = (PlayerA*)userParam;
+	if (drvStruct != NULL && ! cbThreadOptsDone)
+	{
+		cbThreadOptsDone = true;
+		ApplyRenderThreadOpts("audio callback");
+	}
 	if (! (myPlr->GetState() & PLAYSTATE_PLAY))
 	{
 		fprintf(stderr, "Player Warning: calling Render while not playing! playState = 0x%02X\n", myPlr->GetState());
@@ -996,11 +1788,10 @@ static UINT32 FillBuffer(void* drvStruct, void* userParam, UINT32 bufSize, void*
 		return bufSize;
 	}
 	
-	UINT32 renderedBytes;
-	OSMutex_Lock(renderMtx);
-	renderedBytes = myPlr->Render(bufSize, data);
-	OSMutex_Unlock(renderMtx);
-	
+	ApplyRenderCmds(*myPlr);
+	UINT32 renderedBytes = RenderAudio(*myPlr, bufSize, data);
+	CountAudioBuffer(renderedBytes);
+	LogAudioData(data, renderedBytes);
 	return renderedBytes;
 }
 
@@ -1010,6 +1801,159 @@ static UINT32 FillBufferDummy(void* drvStruct, void* userParam, UINT32 bufSize,
 	return bufSize;
 }
 
+static UINT32 FillBufferAhead(void* drvStruct, void* userParam, UINT32 bufSize, void* data)
+{
+	if (! cbThreadOptsDone)
+	{
+		// The callback doesn't render, but it still has to deliver the data in time.
+		cbThreadOptsDone = true;
+		ApplyRenderThreadOpts("audio callback");
+	}
+	UINT32 discardCnt = AtomicLoadAcq(&pcmDiscardCnt);
+	if (discardCnt != pcmDiscardSeen)
+	{
+		// the render thread seeked - skip the audio of the old position or play buffered audio again
+		pcmDiscardSeen = discardCnt;
+		pcmRing.ReadSeek(pcmDiscardPos);
+		pcmRefilling = true;
+	}
+	
+	UINT32 readBytes = (UINT32)pcmRing.Read((UINT8*)data, bufSize);
+	if (readBytes < bufSize)
+	{
+		// buffer underrun or end of song
+		memset((UINT8*)data + readBytes, 0x00, bufSize - readBytes);
+		if (AtomicLoadAcq(&renderEnd) && ! pcmRing.GetReadAvail())
+		{
+			mediaInfo._playState |= PLAYSTATE_END;
+			WakeMainLoop();
+		}
+		else if (statsEnable && ! pcmRefilling)
+		{
+			AtomicStoreRel(&statUnderrunCnt, statUnderrunCnt + 1);
+		}
+	}
+	else
+	{
+		pcmRefilling = false;
+	}
+	CountAudioBuffer(bufSize);
+	OSSignal_Signal(renderWakeSig);
+	LogAudioData(data, bufSize);
+	
+	return bufSize;
+}
+
+// returns true when data was rendered, false when the ring is full or the song ended
+static bool RenderAheadChunk(PlayerA& player)
+{
+	UINT32 fillLvl = (UINT32)(pcmRing.GetSize() - pcmRing.GetWriteAvail());
+	if (renderEnd || fillLvl + renderBuf.size() > renderAheadBytes)
+		return false;
+	
+	UINT32 renderedBytes = RenderAudio(player, (UINT32)renderBuf.size(), &renderBuf[0]);
+	pcmRing.Write(&renderBuf[0], renderedBytes);
+	if (pcmRing.GetWritePos() - pcmHistStart > pcmRing.GetSize())
+		pcmHistStart = pcmRing.GetWritePos() - (UINT32)pcmRing.GetSize();	// keep the distance from wrapping around
+	if (IsRenderEnd(player))
+		AtomicStoreRel(&renderEnd, true);	// set *after* writing the final data
+	return (renderedBytes > 0);
+}
+
+static void RenderThread(void* args)
+{
+	PlayerA& myPlayer = mediaInfo._player;
+	
+	ApplyRenderThreadOpts("render thread");
+	while(! renderThreadStop)
+	{
+		ApplyRenderCmds(myPlayer);
+		if (pcmSeekValid)
+		{
+			// tell the audio callback where to continue
+			pcmDiscardPos = pcmSeekPos;
+			AtomicStoreRel(&pcmDiscardCnt, pcmDiscardCnt + 1);
+			pcmSeekValid = false;
+		}
+		
+		if (! RenderAheadChunk(myPlayer))
+			OSSignal_Wait(renderWakeSig);
+	}
+	
+	return;
+}
+
+static UINT8 StartRenderThread(void)
+{
+	PlayerA& myPlayer = mediaInfo._player;
+	UINT8 retVal;
+	
+	pcmRing.Clear();
+	pcmHistStart = pcmRing.GetWritePos();
+	pcmSeekValid = false;
+	renderEnd = false;
+	renderThreadStop = false;
+	pcmDiscardSeen = pcmDiscardCnt;
+	pcmRefilling = false;
+	// fill the buffer before starting playback, so that we don't begin with an underrun
+	while(RenderAheadChunk(myPlayer))
+		;
+	
+	OSSignal_Reset(renderWakeSig);
+	retVal = OSThread_Init(&renderThread, RenderThread, NULL);
+	if (retVal)
+	{
+		fprintf(stderr, "Error creating render thread! (Error 0x%02X)\n", retVal);
+		renderThread = NULL;
+		return retVal;
+	}
+	return 0x00;
+}
+
+static void StopRenderThread(void)
+{
+	if (renderThread == NULL)
+		return;
+	
+	renderThreadStop = true;
+	OSSignal_Signal(renderWakeSig);
+	OSThread_Join(renderThread);
+	OSThread_Deinit(renderThread);	renderThread = NULL;
+	
+	return;
+}
+
+// applies RenderScheduling/RenderPriority/RenderCPUs to the calling thread
+static void ApplyRenderThreadOpts(const char* thrName)
+{
+	const GeneralOptions& genOpts = mediaInfo._genOpts;
+	int retVal;
+	
+	if (genOpts.renderSched != THRSCHED_NORMAL)
+	{
+		retVal = SetThreadScheduling(genOpts.renderSched, genOpts.renderPrio);
+		if (retVal && ! schedWarnShown)
+		{
+			schedWarnShown = true;
+			if (retVal == EPERM)
+				fprintf(stderr, "Warning: No permission to change the scheduling of the %s! "
+					"(needs CAP_SYS_NICE or RLIMIT_RTPRIO/RLIMIT_NICE)\n", thrName);
+			else
+				fprintf(stderr, "Warning: Unable to change the scheduling of the %s: %s\n", thrName, strerror(retVal));
+		}
+	}
+	if (! genOpts.renderCPUs.empty())
+	{
+		retVal = SetThreadCPUs(genOpts.renderCPUs);
+		if (retVal && ! schedWarnShown)
+		{
+			schedWarnShown = true;
+			fprintf(stderr, "Warning: Unable to bind the %s to the CPU cores of RenderCPUs: %s\n", thrName, strerror(retVal));
+		}
+	}
+	return;
+}
+
 static UINT8 FilePlayCallback(PlayerBase* player, void* userParam, UINT8 evtType, void* evtParam)
 {
 	switch(evtType)
@@ -1027,31 +1971,18 @@ static UINT8 FilePlayCallback(PlayerBase* player, void* userParam, UINT8 evtType
 		mediaInfo.Signal(MI_SIG_POSITION);
 		break;
 	case PLREVT_END:
-		mediaInfo._playState |= PLAYSTATE_END;
+		// In render-ahead mode, the audio callback sets PLAYSTATE_END when the buffer ran empty.
+		if (! renderAhead)
+		{
+			mediaInfo._playState |= PLAYSTATE_END;
+			WakeMainLoop();
+		}
 		//printf("Song End.\n");
 		break;
 	}
 	return 0x00;
 }
 
-static DATA_LOADER* PlayerFileReqCallback(void* userParam, PlayerBase* player, const char* fileName)
-{
-	std::string filePath = FindFile_Single(fileName, appSearchPaths);
-	if (filePath.empty())
-	{
-		fprintf(stderr, "Unable to find %s!\n", fileName);
-		return NULL;
-	}
-	//fprintf(stderr, "Player requested file - found at %s\n", filePath.c_str());
-
-	DATA_LOADER* dLoad = FileLoader_Init(filePath.c_str());
-	UINT8 retVal = DataLoader_Load(dLoad);
-	if (! retVal)
-		return dLoad;
-	DataLoader_Deinit(dLoad);
-	return NULL;
-}
-
 static UINT8 ChooseAudioDriver(AudioDriver* aDrv)
 {
 	// special numbers for aDrv->dTypeID:
@@ -1235,7 +2166,9 @@ static UINT8 InitAudioSystem(void)
 		}
 	}
 
-	retVal = OSMutex_Init(&renderMtx, 0);
+	renderCmdQueue.Init(0x40);
+	OSSignal_Init(&renderWakeSig, 0);
+	OSSignal_Init(&diskWakeSig, 0);
 	
 	return AERR_OK;
 }
@@ -1255,7 +2188,8 @@ static UINT8 DeinitAudioSystem(void)
 	}
 	Audio_Deinit();
 	
-	OSMutex_Deinit(renderMtx);	renderMtx = NULL;
+	OSSignal_Deinit(renderWakeSig);	renderWakeSig = NULL;
+	OSSignal_Deinit(diskWakeSig);	diskWakeSig = NULL;
 	
 	return retVal;
 }
@@ -1278,26 +2212,47 @@ static UINT8 StartAudioDevice(void)
 		return 0xFF;
 	opts->sampleRate = genOpts.smplRate;
 	opts->numChannels = 2;
-	opts->numBitsPerSmpl = 16;
+	// The audio drivers only support integer samples.
+	if (genOpts.smplFmt == SMPLFMT_F32)
+		fprintf(stderr, "Warning: Audio drivers don't support float samples - using 32-bit integer.\n");
+	opts->numBitsPerSmpl = SmplFmt_GetBits(genOpts.smplFmt);
 	if (genOpts.audBufTime)
 		opts->usecPerBuf = genOpts.audBufTime * 1000;
 	if (genOpts.audBufCnt)
 		opts->numBuffers = genOpts.audBufCnt;
-	smplSize = opts->numChannels * opts->numBitsPerSmpl / 8;
-	smplAlloc = opts->sampleRate / 4;
-	localBufSize = smplAlloc * smplSize;
+	if (genOpts.adaptiveBuf && adOut.data != NULL)
+	{
+		if (! adaptBufCnt)
+			adaptBufCnt = adaptBufMin = (opts->numBuffers >= 2) ? opts->numBuffers : 2;	// start with the configured/default number
+		opts->numBuffers = adaptBufCnt;
+	}
 	
 	if (adOut.data != NULL)
 	{
 		//fprintf(stderr, "Opening Device %u ...\n", adOut.deviceID);
+		cbThreadOptsDone = false;	// the driver may use a new thread
 		retVal = AudioDrv_Start(adOut.data, adOut.deviceID);
+		if (retVal && opts->numBitsPerSmpl != 16)
+		{
+			fprintf(stderr, "Device doesn't accept %u-bit samples (Error %02X) - falling back to 16-bit.\n",
+				opts->numBitsPerSmpl, retVal);
+			opts->numBitsPerSmpl = 16;
+			retVal = AudioDrv_Start(adOut.data, adOut.deviceID);
+		}
 		if (retVal)
 		{
 			fprintf(stderr, "Device Init Error: %02X\n", retVal);
 			return retVal;
 		}
-		
+	}
+	smplSize = opts->numChannels * opts->numBitsPerSmpl / 8;
+	smplAlloc = opts->sampleRate / 4;
+	localBufSize = smplAlloc * smplSize;
+	
+	if (adOut.data != NULL)
+	{
 		smplAlloc = AudioDrv_GetBufferSize(adOut.data) / smplSize;
+		audBufUSec = (UINT32)((UINT64)smplAlloc * 1000000 / opts->sampleRate);
 		if (AudioDrv_SetCallback(adOut.data, NULL, NULL) == AERR_OK)
 			localBufSize = 0;	// we don't need a local buffer when the audio driver itself comes with one
 	}
@@ -1307,8 +2262,22 @@ static UINT8 StartAudioDevice(void)
 	}
 	
 	audioBuf.resize(localBufSize);
+	pcmSmplSize = smplSize;
 	mediaInfo._player.SetOutputSettings(opts->sampleRate, opts->numChannels, opts->numBitsPerSmpl, smplAlloc);
 	
+	renderAheadBytes = 0;
+	if (adOut.data != NULL && genOpts.renderAhead > 0)
+	{
+		renderBuf.resize(smplAlloc * smplSize);
+		renderAheadBytes = MSec2Samples(genOpts.renderAhead, mediaInfo._player) * smplSize;
+		if (renderAheadBytes < renderBuf.size() * 2)
+			renderAheadBytes = (UINT32)renderBuf.size() * 2;	// need at least one buffer to render while playing the other one
+		pcmHistBytes = genOpts.seekHistory * opts->sampleRate * smplSize;
+		// The audio callback may read a few buffers while the render thread prepares seeking back,
+		// so reserve some space in order to make sure that the history isn't overwritten.
+		pcmRing.Init(renderAheadBytes + pcmHistBytes + renderBuf.size() * 4);
+	}
+	
 	return AERR_OK;
 }
 
@@ -1320,15 +2289,56 @@ static UINT8 StopAudioDevice(void)
 	if (adOut.data != NULL)
 		retVal = AudioDrv_Stop(adOut.data);
 	audioBuf.clear();
+	renderBuf.clear();
 	
 	return retVal;
 }
 
+// Changing the number of buffers needs a restart of the audio device, so this is done between songs.
+static void AdaptAudioBuffers(void)
+{
+	UINT32 bufTotal = AtomicLoadAcq(&statBufCnt);
+	UINT32 missTotal = AtomicLoadAcq(&statMissCnt) + AtomicLoadAcq(&statUnderrunCnt);
+	UINT32 bufCnt = bufTotal - adaptBufStart;
+	UINT32 missCnt = missTotal - adaptMissStart;
+	UINT32 newBufCnt = adaptBufCnt;
+	
+	adaptBufStart = bufTotal;
+	adaptMissStart = missTotal;
+	if (missCnt > 0)
+	{
+		adaptStableTime = 0.0;
+		newBufCnt = adaptBufCnt + (adaptBufCnt + 1) / 2;
+		if (newBufCnt > adaptBufMin * 8)
+			newBufCnt = adaptBufMin * 8;
+	}
+	else
+	{
+		adaptStableTime += bufCnt * audBufUSec / 1000000.0;
+		if (adaptStableTime >= 60.0 && adaptBufCnt > adaptBufMin)
+		{
+			adaptStableTime = 0.0;
+			newBufCnt = adaptBufCnt - 1;
+		}
+	}
+	if (newBufCnt == adaptBufCnt)
+		return;
+	
+	fprintf(stderr, "Audio buffers: %u -> %u (%u of %u buffers late)\n",
+		adaptBufCnt, newBufCnt, missCnt, bufCnt);
+	StopAudioDevice();
+	adaptBufCnt = newBufCnt;
+	if (StartAudioDevice())
+		fprintf(stderr, "Error restarting the audio device!\n");
+	return;
+}
+
 static UINT8 StartDiskWriter(const std::string& songFileName)
 {
 	if (adLog.data == NULL)
 		return 0x00;
 	
+	const GeneralOptions& genOpts = mediaInfo._genOpts;
 	std::string outFName;
 	const char* extPtr;
 	UINT8 retVal;
@@ -1348,9 +2358,29 @@ static UINT8 StartDiskWriter(const std::string& songFileName)
 	
 	WavWrt_SetFileName(AudioDrv_GetDrvData(adLog.data), outFName.c_str());
 	retVal = AudioDrv_Start(adLog.data, 0);
-	if (! retVal && adOut.data != NULL)
-		AudioDrv_DataForward_Add(adOut.data, adLog.data);
-	return retVal;
+	if (retVal || adOut.data == NULL)
+		return retVal;	// in log-only mode, the main loop writes the file itself
+	
+	const AUDIO_OPTS* opts = AudioDrv_GetOptions(adLog.data);
+	UINT32 bytesPerSec = opts->sampleRate * opts->numChannels * opts->numBitsPerSmpl / 8;
+	if (genOpts.logBufTime > 0)
+	{
+		// Write blocks of 1/4 second. Fewer, larger writes are much cheaper on slow or network drives.
+		diskBlockSize = bytesPerSec / 4;
+		diskBlockSize -= diskBlockSize % (opts->numChannels * opts->numBitsPerSmpl / 8);
+		diskRing.Init((size_t)((UINT64)genOpts.logBufTime * bytesPerSec / 1000) + diskBlockSize);
+		diskDropBytes = 0;
+		diskLateBlocks = 0;
+		diskThreadStop = false;
+		OSSignal_Reset(diskWakeSig);
+		retVal = OSThread_Init(&diskThread, DiskWriterThread, NULL);
+		if (! retVal)
+			return 0x00;
+		fprintf(stderr, "Error creating disk writer thread! (Error 0x%02X)\n", retVal);
+		diskThread = NULL;
+	}
+	AudioDrv_DataForward_Add(adOut.data, adLog.data);	// write from the audio callback
+	return 0x00;
 }
 
 static UINT8 StopDiskWriter(void)
@@ -1358,11 +2388,189 @@ static UINT8 StopDiskWriter(void)
 	if (adLog.data == NULL)
 		return 0x00;
 	
-	if (adOut.data != NULL)
+	if (diskThread != NULL)
+	{
+		// The audio callback was removed already, so the thread can write the remaining data and quit.
+		diskThreadStop = true;
+		OSSignal_Signal(diskWakeSig);
+		OSThread_Join(diskThread);
+		OSThread_Deinit(diskThread);	diskThread = NULL;
+		
+		const AUDIO_OPTS* opts = AudioDrv_GetOptions(adLog.data);
+		UINT32 bytesPerSec = opts->sampleRate * opts->numChannels * opts->numBitsPerSmpl / 8;
+		if (diskDropBytes > 0 || diskLateBlocks > 0)
+			fprintf(stderr, "Warning: Disk writer too slow - %u blocks late, %.2f s of audio dropped from the file\n",
+				diskLateBlocks, (double)diskDropBytes / bytesPerSec);
+		diskRing.Init(0);
+	}
+	else if (adOut.data != NULL)
+	{
 		AudioDrv_DataForward_Remove(adOut.data, adLog.data);
+	}
 	return AudioDrv_Stop(adLog.data);
 }
 
+// called by the audio callback, must never block
+static void LogAudioData(const void* data, UINT32 size)
+{
+	if (diskThread == NULL || ! size)
+		return;
+	
+	UINT32 wrtBytes = (UINT32)diskRing.Write((const UINT8*)data, size);
+	if (wrtBytes < size)
+		AtomicStoreRel(&diskDropBytes, diskDropBytes + (size - wrtBytes));	// the file gets a gap, but playback continues
+	if (diskRing.GetReadAvail() >= diskBlockSize)
+		OSSignal_Signal(diskWakeSig);
+	return;
+}
+
+static void DiskWriterThread(void* args)
+{
+	const AUDIO_OPTS* opts = AudioDrv_GetOptions(adLog.data);
+	double bytesPerSec = (double)opts->sampleRate * opts->numChannels * opts->numBitsPerSmpl / 8;
+	std::vector<UINT8> blockBuf(diskBlockSize);
+	
+	while(true)
+	{
+		size_t avail = diskRing.GetReadAvail();
+		if (avail >= diskBlockSize || (avail > 0 && diskThreadStop))
+		{
+			UINT32 readBytes = (UINT32)diskRing.Read(&blockBuf[0], blockBuf.size());
+			double startTime = GetMonotonicTime();
+			AudioDrv_WriteData(adLog.data, readBytes, &blockBuf[0]);
+			if (GetMonotonicTime() - startTime > readBytes / bytesPerSec)
+				diskLateBlocks ++;
+			continue;
+		}
+		if (diskThreadStop)
+			break;
+		OSSignal_Wait(diskWakeSig);
+	}
+	
+	return;
+}
+
+
+static void MediaEventCB(MediaInfo* mInfo, void* userParam)
+{
+	WakeMainLoop();	// there is a new event in the queue
+	return;
+}
+
+#ifdef _WIN32
+static HANDLE hWakeEvent = NULL;
+
+static UINT8 InitMainLoopWait(void)
+{
+	hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);	// auto-reset event
+	return (hWakeEvent != NULL) ? 0x00 : 0xFF;
+}
+
+static void DeinitMainLoopWait(void)
+{
+	if (hWakeEvent != NULL)
+	{
+		CloseHandle(hWakeEvent);	hWakeEvent = NULL;
+	}
+	return;
+}
+
+// may be called from any thread, including the audio callback
+static void WakeMainLoop(void)
+{
+	if (hWakeEvent != NULL)
+		SetEvent(hWakeEvent);
+	return;
+}
+
+static void WaitForMainLoopEvent(UINT32 timeoutMS)
+{
+	HANDLE hStdIn = GetStdHandle(STD_INPUT_HANDLE);
+	HANDLE waitHndls[2];
+	DWORD hndlCnt = 0;
+	
+	if (hWakeEvent != NULL)
+		waitHndls[hndlCnt ++] = hWakeEvent;
+	// only console handles signal key presses - redirected files are always signalled
+	if (hStdIn != INVALID_HANDLE_VALUE && GetFileType(hStdIn) == FILE_TYPE_CHAR)
+		waitHndls[hndlCnt ++] = hStdIn;
+	if (! hndlCnt)
+	{
+		Sleep((timeoutMS == (UINT32)-1) ? 50 : timeoutMS);
+		return;
+	}
+	WaitForMultipleObjects(hndlCnt, waitHndls, FALSE, (timeoutMS == (UINT32)-1) ? INFINITE : timeoutMS);
+	return;
+}
+#else
+static int wakePipe[2] = {-1, -1};	// self-pipe, [0] = read end, [1] = write end
+
+static UINT8 InitMainLoopWait(void)
+{
+	int retVal = pipe(wakePipe);
+	if (retVal)
+	{
+		wakePipe[0] = wakePipe[1] = -1;
+		return 0xFF;
+	}
+	// non-blocking on both ends: the audio thread must never wait for us
+	fcntl(wakePipe[0], F_SETFL, fcntl(wakePipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(wakePipe[1], F_SETFL, fcntl(wakePipe[1], F_GETFL) | O_NONBLOCK);
+	return 0x00;
+}
+
+static void DeinitMainLoopWait(void)
+{
+	if (wakePipe[0] != -1)
+	{
+		close(wakePipe[0]);
+		close(wakePipe[1]);
+		wakePipe[0] = wakePipe[1] = -1;
+	}
+	return;
+}
+
+// may be called from any thread, including the audio callback
+static void WakeMainLoop(void)
+{
+	if (wakePipe[1] != -1)
+	{
+		char dummy = 0x00;
+		ssize_t wrtBytes = write(wakePipe[1], &dummy, 1);	// fails with EAGAIN when there are enough wakeups queued
+		(void)wrtBytes;
+	}
+	return;
+}
+
+static void WaitForMainLoopEvent(UINT32 timeoutMS)
+{
+	struct pollfd pfds[3];
+	nfds_t fdCnt = 0;
+	int mcFD = mediaCtrl.GetWaitFD();
+	
+	if (! feof(stdin))	// stdin redirected from a file that was read completely: it would always be "readable"
+	{
+		pfds[fdCnt].fd = STDIN_FILENO;	pfds[fdCnt].events = POLLIN;	fdCnt ++;
+	}
+	if (wakePipe[0] != -1)
+	{
+		pfds[fdCnt].fd = wakePipe[0];	pfds[fdCnt].events = POLLIN;	fdCnt ++;
+	}
+	if (mcFD != -1)
+	{
+		pfds[fdCnt].fd = mcFD;	pfds[fdCnt].events = POLLIN;	fdCnt ++;
+	}
+	
+	poll(pfds, fdCnt, (timeoutMS == (UINT32)-1) ? -1 : (int)timeoutMS);
+	if (wakePipe[0] != -1)
+	{
+		char dummy[0x10];
+		while(read(wakePipe[0], dummy, sizeof(dummy)) > 0)
+			;	// empty the pipe
+	}
+	return;
+}
+#endif
 
 #ifdef WIN32
 static void cls(void)
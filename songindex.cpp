@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <stdtype.h>
+#include <utils/OSMutex.h>
+#include <player/playera.hpp>
+
+#include "utils.hpp"
+#include "songindex.hpp"
+#include "mediainfo.hpp"
+
+
+/*
+Index file format (all values Little Endian)
+	00  4  signature "VIDX"
+	04  4  version
+	08  -  records
+
+Record
+	00  4  size of the record, excluding this field
+	04  8  file size of the song
+	0C  8  modification time of the song
+	14  4  length in ms
+	18  4  loop length in ms (0 = no loop)
+	1C  -  strings (2 bytes length + UTF-8 data):
+	       song path, format, version,
+	       number of chips (2 bytes) + chip names,
+	       number of tags (2 bytes) + tag key/value pairs
+Records are only appended. When a song has multiple records, the last one is valid.
+*/
+#define INDEX_HDR_SIZE	0x08
+#define INDEX_VERSION	0x01
+#define REC_HDR_SIZE	0x1C
+
+static bool ParseRecord(const std::vector<UINT8>& data, size_t recOfs, std::string* songPath,
+	UINT64* fileSize, UINT64* mtime, SongIndexEntry* entry);
+static void WriteStr(std::vector<UINT8>& data, const std::string& str);
+static bool ReadStr(const std::vector<UINT8>& data, size_t& pos, size_t endPos, std::string& str);
+static inline UINT16 ReadLE16(const UINT8* buffer);
+static inline UINT32 ReadLE32(const UINT8* buffer);
+static inline UINT64 ReadLE64(const UINT8* buffer);
+static inline void WriteLE32(UINT8* buffer, UINT32 value);
+static inline void WriteLE64(UINT8* buffer, UINT64 value);
+
+SongIndex::SongIndex() :
+	_hFile(NULL),
+	_mutex(NULL),
+	_staleCnt(0)
+{
+	OSMutex_Init(&_mutex, 0);
+}
+
+SongIndex::~SongIndex()
+{
+	Close();
+	OSMutex_Deinit(_mutex);
+}
+
+UINT8 SongIndex::Open(const std::string& filePath)
+{
+	FILE* hFile;
+	long fileSize;
+	size_t curPos;
+	
+	Close();
+	if (filePath.empty())
+		return 0x00;
+	
+	// The index is small compared to the songs (a few hundred bytes per song), so it is read as a whole.
+	_data.clear();
+	hFile = fopen_utf8(filePath, "rb");
+	if (hFile != NULL)
+	{
+		if (! fseek(hFile, 0, SEEK_END) && (fileSize = ftell(hFile)) > 0)
+		{
+			_data.resize((size_t)fileSize);
+			rewind(hFile);
+			_data.resize(fread(&_data[0], 1, _data.size(), hFile));
+		}
+		fclose(hFile);
+	}
+	if (_data.size() < INDEX_HDR_SIZE || memcmp(&_data[0x00], "VIDX", 4) || ReadLE32(&_data[0x04]) != INDEX_VERSION)
+	{
+		// new file or unknown format: start a new index
+		_data.resize(INDEX_HDR_SIZE);
+		memcpy(&_data[0x00], "VIDX", 4);
+		WriteLE32(&_data[0x04], INDEX_VERSION);
+	}
+	
+	_entryOfs.clear();
+	_staleCnt = 0;
+	for (curPos = INDEX_HDR_SIZE; curPos + 4 <= _data.size(); )
+	{
+		std::string songPath;
+		size_t recSize = ReadLE32(&_data[curPos]);
+		if (recSize > _data.size() - curPos - 4 || ! ParseRecord(_data, curPos, &songPath, NULL, NULL, NULL))
+			break;	// incomplete write, everything after it is dropped
+		if (_entryOfs.find(songPath) != _entryOfs.end())
+			_staleCnt ++;
+		_entryOfs[songPath] = curPos;
+		curPos += 4 + recSize;
+	}
+	_filePath = filePath;
+	
+	if (curPos < _data.size() || _data.size() == INDEX_HDR_SIZE || _staleCnt > _entryOfs.size())
+	{
+		_data.resize(curPos);
+		if (Compact())
+			return 0xFF;
+	}
+	_hFile = fopen_utf8(_filePath, "ab");
+	if (_hFile == NULL)
+		return 0xFF;
+	// unbuffered: every record is written by a single write() call, so that a scan and a player
+	// that add songs at the same time don't mix up their records
+	setvbuf(_hFile, NULL, _IONBF, 0);
+	return 0x00;
+}
+
+void SongIndex::Close(void)
+{
+	if (_hFile == NULL)
+		return;
+	
+	OSMutex_Lock(_mutex);
+	fclose(_hFile);	_hFile = NULL;
+	_data.clear();
+	_entryOfs.clear();
+	_staleCnt = 0;
+	OSMutex_Unlock(_mutex);
+	return;
+}
+
+UINT8 SongIndex::Lookup(const std::string& songPath, UINT64 fileSize, UINT64 mtime, SongIndexEntry& entry)
+{
+	std::map<std::string, size_t>::const_iterator entIt;
+	std::string absPath;
+	UINT64 recFileSize;
+	UINT64 recMTime;
+	UINT8 retVal;
+	
+	if (! IsEnabled())
+		return 0xFF;
+	
+	absPath = GetAbsolutePath(songPath);
+	OSMutex_Lock(_mutex);
+	entIt = _entryOfs.find(absPath);
+	if (entIt == _entryOfs.end())
+		retVal = 0xFF;	// not indexed
+	else if (! ParseRecord(_data, entIt->second, NULL, &recFileSize, &recMTime, &entry))
+		retVal = 0x80;
+	else if (recFileSize != fileSize || recMTime != mtime)
+		retVal = 0x01;	// the file was modified
+	else
+		retVal = 0x00;
+	OSMutex_Unlock(_mutex);
+	
+	return retVal;
+}
+
+UINT8 SongIndex::Store(const std::string& songPath, UINT64 fileSize, UINT64 mtime, const SongIndexEntry& entry)
+{
+	std::vector<UINT8> record;
+	std::map<std::string, std::string>::const_iterator tagIt;
+	std::string absPath;
+	size_t curChip;
+	UINT8 retVal;
+	
+	if (! IsEnabled())
+		return 0xFF;
+	
+	// the same song can be passed with different relative paths
+	absPath = GetAbsolutePath(songPath);
+	record.resize(REC_HDR_SIZE);
+	WriteLE64(&record[0x04], fileSize);
+	WriteLE64(&record[0x0C], mtime);
+	WriteLE32(&record[0x14], entry.length);
+	WriteLE32(&record[0x18], entry.loopLength);
+	WriteStr(record, absPath);
+	WriteStr(record, entry.format);
+	WriteStr(record, entry.version);
+	record.push_back((UINT8)(entry.chips.size() >> 0));
+	record.push_back((UINT8)(entry.chips.size() >> 8));
+	for (curChip = 0; curChip < entry.chips.size(); curChip ++)
+		WriteStr(record, entry.chips[curChip]);
+	record.push_back((UINT8)(entry.tags.size() >> 0));
+	record.push_back((UINT8)(entry.tags.size() >> 8));
+	for (tagIt = entry.tags.begin(); tagIt != entry.tags.end(); ++tagIt)
+	{
+		WriteStr(record, tagIt->first);
+		WriteStr(record, tagIt->second);
+	}
+	WriteLE32(&record[0x00], (UINT32)(record.size() - 4));
+	
+	OSMutex_Lock(_mutex);
+	retVal = 0x00;
+	if (fwrite(&record[0], 1, record.size(), _hFile) < record.size())
+	{
+		retVal = 0xC0;	// probably out of disk space
+	}
+	else
+	{
+		if (_entryOfs.find(absPath) != _entryOfs.end())
+			_staleCnt ++;
+		_entryOfs[absPath] = _data.size();
+		_data.insert(_data.end(), record.begin(), record.end());
+	}
+	OSMutex_Unlock(_mutex);
+	
+	return retVal;
+}
+
+void SongIndex::MakeEntry(MediaInfo& mInfo, SongIndexEntry& entry)
+{
+	PlayerA& player = mInfo._player;
+	size_t curDev;
+	
+	entry.format = mInfo._fileFmt;
+	entry.version = mInfo._fileVerStr;
+	entry.length = (UINT32)(player.GetTotalTime(0) * 1000.0 + 0.5);
+	entry.loopLength = mInfo._looping ? (UINT32)(player.GetLoopTime() * 1000.0 + 0.5) : 0;
+	entry.chips.clear();
+	for (curDev = 0; curDev < mInfo._chipList.size(); curDev ++)
+		entry.chips.push_back(mInfo._chipList[curDev].name);
+	entry.tags = mInfo._songTags;
+	return;
+}
+
+// rewrites the index file with only the newest record of each song
+UINT8 SongIndex::Compact(void)
+{
+	std::vector<UINT8> newData;
+	std::map<std::string, size_t>::iterator entIt;
+	std::string tempPath;
+	FILE* hFile;
+	bool writeError;
+	
+	newData.assign(_data.begin(), _data.begin() + INDEX_HDR_SIZE);
+	for (entIt = _entryOfs.begin(); entIt != _entryOfs.end(); ++entIt)
+	{
+		size_t recOfs = entIt->second;
+		size_t recEnd = recOfs + 4 + ReadLE32(&_data[recOfs]);
+		entIt->second = newData.size();
+		newData.insert(newData.end(), _data.begin() + recOfs, _data.begin() + recEnd);
+	}
+	_data.swap(newData);
+	_staleCnt = 0;
+	
+	// write to a temporary file first, so that an interrupted write doesn't lose the index
+	tempPath = _filePath + ".tmp";
+	hFile = fopen_utf8(tempPath, "wb");
+	if (hFile == NULL)
+		return 0xC0;
+	writeError = false;
+	if (fwrite(&_data[0], 1, _data.size(), hFile) < _data.size())
+		writeError = true;
+	if (fclose(hFile))
+		writeError = true;
+	if (writeError)
+	{
+		remove(tempPath.c_str());
+		return 0xC1;
+	}
+#ifdef _WIN32
+	remove(_filePath.c_str());	// rename() doesn't replace existing files on Windows
+#endif
+	if (rename(tempPath.c_str(), _filePath.c_str()))
+	{
+		remove(tempPath.c_str());
+		return 0xC2;
+	}
+	return 0x00;
+}
+
+// All pointers are optional, the record is checked completely in any case.
+static bool ParseRecord(const std::vector<UINT8>& data, size_t recOfs, std::string* songPath,
+	UINT64* fileSize, UINT64* mtime, SongIndexEntry* entry)
+{
+	size_t endPos = recOfs + 4 + ReadLE32(&data[recOfs]);
+	size_t curPos = recOfs + REC_HDR_SIZE;
+	std::string pathStr;
+	SongIndexEntry ent;
+	std::string key;
+	std::string value;
+	UINT16 itemCnt;
+	UINT16 curItm;
+	
+	if (endPos > data.size() || curPos > endPos)
+		return false;
+	if (! ReadStr(data, curPos, endPos, pathStr) || ! ReadStr(data, curPos, endPos, ent.format) ||
+		! ReadStr(data, curPos, endPos, ent.version))
+		return false;
+	
+	if (curPos + 2 > endPos)
+		return false;
+	itemCnt = ReadLE16(&data[curPos]);	curPos += 2;
+	ent.chips.resize(itemCnt);
+	for (curItm = 0; curItm < itemCnt; curItm ++)
+	{
+		if (! ReadStr(data, curPos, endPos, ent.chips[curItm]))
+			return false;
+	}
+	
+	if (curPos + 2 > endPos)
+		return false;
+	itemCnt = ReadLE16(&data[curPos]);	curPos += 2;
+	for (curItm = 0; curItm < itemCnt; curItm ++)
+	{
+		if (! ReadStr(data, curPos, endPos, key) || ! ReadStr(data, curPos, endPos, value))
+			return false;
+		ent.tags[key] = value;
+	}
+	ent.length = ReadLE32(&data[recOfs + 0x14]);
+	ent.loopLength = ReadLE32(&data[recOfs + 0x18]);
+	
+	if (songPath != NULL)
+		songPath->swap(pathStr);
+	if (fileSize != NULL)
+		*fileSize = ReadLE64(&data[recOfs + 0x04]);
+	if (mtime != NULL)
+		*mtime = ReadLE64(&data[recOfs + 0x0C]);
+	if (entry != NULL)
+		*entry = ent;
+	return true;
+}
+
+static void WriteStr(std::vector<UINT8>& data, const std::string& str)
+{
+	size_t len = (str.length() < 0xFFFF) ? str.length() : 0xFFFF;
+	data.push_back((UINT8)(len >> 0));
+	data.push_back((UINT8)(len >> 8));
+	data.insert(data.end(), str.begin(), str.begin() + len);
+	return;
+}
+
+static bool ReadStr(const std::vector<UINT8>& data, size_t& pos, size_t endPos, std::string& str)
+{
+	size_t len;
+	
+	if (pos + 2 > endPos)
+		return false;
+	len = ReadLE16(&data[pos]);
+	pos += 2;
+	if (pos + len > endPos)
+		return false;
+	str.assign((const char*)&data[pos], len);
+	pos += len;
+	return true;
+}
+
+static inline UINT16 ReadLE16(const UINT8* buffer)
+{
+	return (buffer[0x00] << 0) | (buffer[0x01] << 8);
+}
+
+static inline UINT32 ReadLE32(const UINT8* buffer)
+{
+	return	(buffer[0x00] <<  0) | (buffer[0x01] <<  8) |
+			(buffer[0x02] << 16) | ((UINT32)buffer[0x03] << 24);
+}
+
+static inline UINT64 ReadLE64(const UINT8* buffer)
+{
+	return ((UINT64)ReadLE32(&buffer[0x04]) << 32) | ReadLE32(&buffer[0x00]);
+}
+
+static inline void WriteLE32(UINT8* buffer, UINT32 value)
+{
+	buffer[0x00] = (UINT8)((value >>  0) & 0xFF);
+	buffer[0x01] = (UINT8)((value >>  8) & 0xFF);
+	buffer[0x02] = (UINT8)((value >> 16) & 0xFF);
+	buffer[0x03] = (UINT8)((value >> 24) & 0xFF);
+	return;
+}
+
+static inline void WriteLE64(UINT8* buffer, UINT64 value)
+{
+	WriteLE32(&buffer[0x00], (UINT32)(value >>  0));
+	WriteLE32(&buffer[0x04], (UINT32)(value >> 32));
+	return;
+}
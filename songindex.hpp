@@ -0,0 +1,54 @@
+#ifndef __SONGINDEX_HPP__
+#define __SONGINDEX_HPP__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdtype.h>
+#include <utils/OSMutex.h>
+
+class MediaInfo;
+
+struct SongIndexEntry
+{
+	std::string format;
+	std::string version;
+	UINT32 length;	// in ms, without loops
+	UINT32 loopLength;	// in ms, 0 = no loop
+	std::vector<std::string> chips;
+	std::map<std::string, std::string> tags;	// after the language filter
+};
+
+// on-disk index of song information, keyed by absolute file path, size and modification time
+// New entries are appended to the file, an entry replaces all older entries for the same path.
+// Lookup and Store may be called from multiple threads.
+class SongIndex
+{
+public:
+	SongIndex();
+	~SongIndex();
+	
+	// empty path = index disabled
+	UINT8 Open(const std::string& filePath);
+	void Close(void);
+	bool IsEnabled(void) const	{ return _hFile != NULL; }
+	
+	// returns 0x00 when there is an entry that matches the current size/modification time of the song
+	UINT8 Lookup(const std::string& songPath, UINT64 fileSize, UINT64 mtime, SongIndexEntry& entry);
+	UINT8 Store(const std::string& songPath, UINT64 fileSize, UINT64 mtime, const SongIndexEntry& entry);
+	// information of the loaded song, PreparePlayback() and EnumerateChips() must be called before
+	static void MakeEntry(MediaInfo& mInfo, SongIndexEntry& entry);
+	
+private:
+	UINT8 Compact(void);
+	
+	std::string _filePath;
+	FILE* _hFile;	// opened for appending
+	OS_MUTEX* _mutex;
+	std::vector<UINT8> _data;	// contents of the index file
+	std::map<std::string, size_t> _entryOfs;	// path -> offset of the newest record in _data
+	size_t _staleCnt;	// records that were replaced by newer ones
+};
+
+#endif	// __SONGINDEX_HPP__
@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <map>
+
+#include <stdtype.h>
+#include <utils/DataLoader.h>
+#include <player/playerbase.hpp>
+#include <player/s98player.hpp>
+#include <player/droplayer.hpp>
+#include <player/vgmplayer.hpp>
+#include <player/playera.hpp>
+#include <utils/OSMutex.h>
+#include <utils/OSThread.h>
+
+#include "utils.hpp"
+#include "config.hpp"
+#include "m3uargparse.hpp"
+#include "playcfg.hpp"
+#include "mediainfo.hpp"
+#include "loaders.hpp"
+#include "songindex.hpp"
+#include "songscan.hpp"
+
+
+struct ScanWorker
+{
+	MediaInfo* mInfo;
+	OS_THREAD* thread;
+};
+
+
+//UINT8 ScanMain(FILE* hFile);
+static void ScanWorkerThread(void* args);
+static UINT8 ScanSong(MediaInfo& mInfo, size_t songIdx, std::string& record);
+static UINT8 LoadSongInfo(MediaInfo& mInfo, size_t songIdx, SongIndexEntry& entry);
+static void OutputRecord(size_t songIdx, const std::string& record, bool failed);
+static std::string JSONString(const std::string& str);
+
+
+extern Configuration playerCfg;
+extern std::vector<SongFileList> songList;
+
+// job queue shared by all workers
+static OS_MUTEX* jobMutex = NULL;
+static size_t nextSong;
+static size_t errCnt;
+static SongIndex songIndex;
+// Records are printed in song list order, finished records wait here until all songs before them are done.
+static FILE* scanOut = NULL;
+static std::vector<std::string> records;
+static std::vector<bool> recDone;
+static size_t nextOut;
+
+UINT8 ScanMain(FILE* hFile)
+{
+	std::vector<ScanWorker> workers;
+	GeneralOptions genOpts;
+	size_t curWrk;
+	size_t thrCnt;
+	UINT8 retVal;
+	
+	// Only the general options are needed, the chip options don't change the song information.
+	{
+		MediaInfo* mInfo = new MediaInfo;	// allocated on the heap, because the chip options are large
+		ParseConfiguration(mInfo->_genOpts, 0x100, mInfo->_chipOpts, playerCfg);
+		genOpts = mInfo->_genOpts;
+		delete mInfo;
+	}
+	thrCnt = genOpts.renderThreads ? genOpts.renderThreads : GetCPUCoreCount();
+	if (thrCnt > songList.size())
+		thrCnt = songList.size();
+	if (thrCnt < 1)
+		thrCnt = 1;
+	
+	Loaders_Init();
+	retVal = songIndex.Open(genOpts.songIndexFile);
+	if (retVal)
+		fprintf(stderr, "Warning: Unable to open the song index %s!\n", genOpts.songIndexFile.c_str());
+	workers.resize(thrCnt);
+	for (curWrk = 0; curWrk < workers.size(); curWrk ++)
+	{
+		MediaInfo* mInfo = new MediaInfo;
+		PlayerA& player = mInfo->_player;
+		
+		mInfo->_genOpts = genOpts;
+		mInfo->_enableAlbumImage = false;
+		mInfo->_playState = 0x00;
+		mInfo->_pbSongCnt = songList.size();
+		// no sound devices are started, loading the file is enough for the song information
+		player.RegisterPlayerEngine(new VGMPlayer);
+		player.RegisterPlayerEngine(new S98Player);
+		player.RegisterPlayerEngine(new DROPlayer);
+		player.SetOutputSettings(genOpts.smplRate, 2, 16, 0x100);
+		workers[curWrk].mInfo = mInfo;
+		workers[curWrk].thread = NULL;
+	}
+	
+	scanOut = hFile;
+	setvbuf(scanOut, NULL, _IOFBF, 0x10000);
+	records.assign(songList.size(), std::string());
+	recDone.assign(songList.size(), false);
+	nextOut = 0;
+	nextSong = 0;
+	errCnt = 0;
+	OSMutex_Init(&jobMutex, 0);
+	// worker 0 runs in the main thread
+	for (curWrk = 1; curWrk < workers.size(); curWrk ++)
+	{
+		retVal = OSThread_Init(&workers[curWrk].thread, ScanWorkerThread, &workers[curWrk]);
+		if (retVal)
+			workers[curWrk].thread = NULL;	// the remaining workers will do the job
+	}
+	ScanWorkerThread(&workers[0]);
+	for (curWrk = 1; curWrk < workers.size(); curWrk ++)
+	{
+		if (workers[curWrk].thread == NULL)
+			continue;
+		OSThread_Join(workers[curWrk].thread);
+		OSThread_Deinit(workers[curWrk].thread);
+	}
+	OSMutex_Deinit(jobMutex);	jobMutex = NULL;
+	fclose(scanOut);	scanOut = NULL;
+	records.clear();
+	recDone.clear();
+	printf("Scanned %u files, %u failed.\n", (unsigned)songList.size(), (unsigned)errCnt);
+	
+	for (curWrk = 0; curWrk < workers.size(); curWrk ++)
+	{
+		workers[curWrk].mInfo->_player.UnregisterAllPlayers();
+		delete workers[curWrk].mInfo;
+	}
+	songIndex.Close();
+	Loaders_Deinit();
+	
+	return errCnt ? 1 : 0;
+}
+
+static void ScanWorkerThread(void* args)
+{
+	ScanWorker* sw = (ScanWorker*)args;
+	
+	while(true)
+	{
+		size_t curSong;
+		std::string record;
+		UINT8 retVal;
+		
+		OSMutex_Lock(jobMutex);
+		curSong = nextSong;
+		if (curSong < songList.size())
+			nextSong ++;
+		OSMutex_Unlock(jobMutex);
+		if (curSong >= songList.size())
+			break;
+		
+		retVal = ScanSong(*sw->mInfo, curSong, record);
+		OutputRecord(curSong, record, retVal != 0x00);
+	}
+	
+	return;
+}
+
+static UINT8 ScanSong(MediaInfo& mInfo, size_t songIdx, std::string& record)
+{
+	const SongFileList& sfl = songList[songIdx];
+	SongIndexEntry entry;
+	UINT64 mtime;
+	UINT64 fileSize;
+	bool hasStamp;
+	UINT8 retVal;
+	char numStr[0x40];
+	
+	record = "{\"file\":" + JSONString(sfl.fileName);
+	// unchanged songs are taken from the index, only their directory entry is read
+	hasStamp = GetFileStampU8(sfl.fileName, mtime, fileSize);
+	if (! hasStamp || songIndex.Lookup(sfl.fileName, fileSize, mtime, entry))
+	{
+		retVal = LoadSongInfo(mInfo, songIdx, entry);
+		if (retVal)
+		{
+			record += (retVal == 0xFE) ? ",\"error\":\"format\"}" : ",\"error\":\"open\"}";
+			return retVal;
+		}
+		if (hasStamp)
+			songIndex.Store(sfl.fileName, fileSize, mtime, entry);
+	}
+	
+	record += ",\"format\":" + JSONString(entry.format);
+	record += ",\"version\":" + JSONString(entry.version);
+	// times in seconds, "loop" is 0 for songs that don't loop
+	snprintf(numStr, sizeof(numStr), ",\"length\":%.3f,\"loop\":%.3f",
+		entry.length / 1000.0, entry.loopLength / 1000.0);
+	record += numStr;
+	
+	record += ",\"chips\":[";
+	for (size_t curChip = 0; curChip < entry.chips.size(); curChip ++)
+	{
+		if (curChip > 0)
+			record += ",";
+		record += JSONString(entry.chips[curChip]);
+	}
+	record += "]";
+	
+	record += ",\"tags\":{";
+	std::map<std::string, std::string>::const_iterator tagIt;
+	for (tagIt = entry.tags.begin(); tagIt != entry.tags.end(); ++tagIt)
+	{
+		if (tagIt != entry.tags.begin())
+			record += ",";
+		record += JSONString(tagIt->first) + ":" + JSONString(tagIt->second);
+	}
+	record += "}}";
+	
+	return 0x00;
+}
+
+static UINT8 LoadSongInfo(MediaInfo& mInfo, size_t songIdx, SongIndexEntry& entry)
+{
+	PlayerA& player = mInfo._player;
+	const SongFileList& sfl = songList[songIdx];
+	DATA_LOADER* dLoad;
+	UINT8 retVal;
+	
+	dLoad = GetSongInfoLoaderUTF8(sfl.fileName);
+	if (dLoad == NULL)
+		return 0xFF;
+	DataLoader_SetPreloadBytes(dLoad, 0x100);
+	retVal = DataLoader_Load(dLoad);
+	if (retVal)
+	{
+		DataLoader_CancelLoading(dLoad);
+		DataLoader_Deinit(dLoad);
+		return 0xFF;
+	}
+	retVal = player.LoadFile(dLoad);
+	if (retVal)
+	{
+		DataLoader_CancelLoading(dLoad);
+		DataLoader_Deinit(dLoad);
+		return 0xFE;
+	}
+	
+	mInfo._pbSongID = songIdx;
+	mInfo._songPath = sfl.fileName;
+	mInfo._playlistTrkID = sfl.playlistSongID;
+	mInfo._fileEndPos = player.GetFileSize();
+	mInfo.PreparePlayback();
+	mInfo.EnumerateChips();
+	SongIndex::MakeEntry(mInfo, entry);
+	
+	player.UnloadFile();
+	DataLoader_Deinit(dLoad);
+	
+	return 0x00;
+}
+
+static void OutputRecord(size_t songIdx, const std::string& record, bool failed)
+{
+	OSMutex_Lock(jobMutex);
+	if (failed)
+		errCnt ++;
+	records[songIdx] = record;
+	recDone[songIdx] = true;
+	for (; nextOut < records.size() && recDone[nextOut]; nextOut ++)
+	{
+		fputs(records[nextOut].c_str(), scanOut);
+		fputc('\n', scanOut);
+		std::string().swap(records[nextOut]);	// free the memory
+	}
+	OSMutex_Unlock(jobMutex);
+	return;
+}
+
+// quoted string with JSON escapes, UTF-8 is passed through
+static std::string JSONString(const std::string& str)
+{
+	std::string result;
+	size_t curChr;
+	
+	result.reserve(str.length() + 2);
+	result += '"';
+	for (curChr = 0; curChr < str.length(); curChr ++)
+	{
+		unsigned char c = (unsigned char)str[curChr];
+		if (c == '"' || c == '\\')
+		{
+			result += '\\';
+			result += (char)c;
+		}
+		else if (c == '\n')
+		{
+			result += "\\n";
+		}
+		else if (c == '\t')
+		{
+			result += "\\t";
+		}
+		else if (c < 0x20)
+		{
+			char escStr[0x08];
+			snprintf(escStr, sizeof(escStr), "\\u%04X", c);
+			result += escStr;
+		}
+		else
+		{
+			result += (char)c;
+		}
+	}
+	result += '"';
+	return result;
+}
@@ -0,0 +1,11 @@
+#ifndef __SONGSCAN_HPP__
+#define __SONGSCAN_HPP__
+
+#include <stdio.h>
+#include <stdtype.h>
+
+// Print the song information (format, length, loop, chips, tags) of all songs of the song list to hFile,
+// one JSON object per line in song list order. The songs are loaded in parallel, but never played.
+UINT8 ScanMain(FILE* hFile);
+
+#endif	// __SONGSCAN_HPP__
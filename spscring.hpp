@@ -0,0 +1,153 @@
+#ifndef __SPSCRING_HPP__
+#define __SPSCRING_HPP__
+
+#include <stddef.h>
+#include <string.h>	// for memcpy()
+#include <vector>
+#include <stdtype.h>
+
+// memory ordering helpers for data that is shared between exactly two threads
+#if defined(__GNUC__)
+template<typename T> static inline T AtomicLoadAcq(const volatile T* ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+template<typename T> static inline void AtomicStoreRel(volatile T* ptr, T value)
+{
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+	return;
+}
+#elif defined(_MSC_VER) && _MSC_VER >= 1400
+#include <intrin.h>
+#pragma intrinsic(_ReadWriteBarrier)
+// MSVC gives volatile accesses acquire/release semantics, we only need to stop the compiler from reordering.
+template<typename T> static inline T AtomicLoadAcq(const volatile T* ptr)
+{
+	T value = *ptr;
+	_ReadWriteBarrier();
+	return value;
+}
+template<typename T> static inline void AtomicStoreRel(volatile T* ptr, T value)
+{
+	_ReadWriteBarrier();
+	*ptr = value;
+	return;
+}
+#else
+// plain volatile access (sufficient for the x86 memory model)
+template<typename T> static inline T AtomicLoadAcq(const volatile T* ptr)
+{
+	return *ptr;
+}
+template<typename T> static inline void AtomicStoreRel(volatile T* ptr, T value)
+{
+	*ptr = value;
+	return;
+}
+#endif
+
+// Lock-free single-producer/single-consumer ring buffer.
+// Write*() may only be called by the producer thread, Read*() only by the consumer thread.
+// Init() and Clear() are not thread-safe.
+template<typename T>
+class SPSCRing
+{
+public:
+	SPSCRing() : _mask(0), _readPos(0), _writePos(0)	{}
+
+	void Init(size_t minSize)
+	{
+		size_t bufSize = 1;
+		while(bufSize < minSize)
+			bufSize <<= 1;	// round up to power of 2, so that the 32-bit positions can wrap around
+		_buf.resize(bufSize);
+		_mask = (UINT32)(bufSize - 1);
+		Clear();
+		return;
+	}
+	void Clear(void)
+	{
+		_readPos = 0;
+		_writePos = 0;
+		return;
+	}
+	size_t GetSize(void) const
+	{
+		return _buf.size();
+	}
+
+	size_t GetReadAvail(void) const
+	{
+		return (size_t)(AtomicLoadAcq(&_writePos) - _readPos);
+	}
+	size_t GetWriteAvail(void) const
+	{
+		return _buf.size() - (size_t)(_writePos - AtomicLoadAcq(&_readPos));
+	}
+
+	size_t Write(const T* data, size_t count)
+	{
+		size_t avail = GetWriteAvail();
+		if (count > avail)
+			count = avail;
+		if (! count)
+			return 0;
+
+		UINT32 wPos = _writePos & _mask;
+		size_t part1 = _buf.size() - wPos;
+		if (part1 > count)
+			part1 = count;
+		memcpy(&_buf[wPos], data, part1 * sizeof(T));
+		if (part1 < count)
+			memcpy(&_buf[0], data + part1, (count - part1) * sizeof(T));
+		AtomicStoreRel(&_writePos, (UINT32)(_writePos + count));
+		return count;
+	}
+	size_t Read(T* data, size_t count)
+	{
+		size_t avail = GetReadAvail();
+		if (count > avail)
+			count = avail;
+		if (! count)
+			return 0;
+
+		UINT32 rPos = _readPos & _mask;
+		size_t part1 = _buf.size() - rPos;
+		if (part1 > count)
+			part1 = count;
+		memcpy(data, &_buf[rPos], part1 * sizeof(T));
+		if (part1 < count)
+			memcpy(data + part1, &_buf[0], (count - part1) * sizeof(T));
+		AtomicStoreRel(&_readPos, (UINT32)(_readPos + count));
+		return count;
+	}
+
+	// producer: get the position where the next Write() will put its data
+	UINT32 GetWritePos(void) const
+	{
+		return _writePos;
+	}
+	// producer: get the position where the consumer will read next
+	UINT32 GetReadPos(void) const
+	{
+		return AtomicLoadAcq(&_readPos);
+	}
+	// consumer: continue reading at position "pos"
+	// Seeking forward drops data. Seeking backward reads data again, so the caller has to make sure
+	// that the producer didn't overwrite it yet.
+	void ReadSeek(UINT32 pos)
+	{
+		if ((size_t)(AtomicLoadAcq(&_writePos) - pos) > _buf.size())
+			return;	// invalid position
+		AtomicStoreRel(&_readPos, pos);
+		return;
+	}
+
+private:
+	std::vector<T> _buf;
+	UINT32 _mask;
+	volatile UINT32 _readPos;	// written by consumer only
+	volatile UINT32 _writePos;	// written by producer only
+};
+
+#endif	// __SPSCRING_HPP__
@@ -4,24 +4,73 @@
 #include <stdio.h>
 #include <vector>
 #include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <map>
+#include <set>
 
 #ifdef _WIN32
 #include <Windows.h>	// for WriteConsoleW etc.
+#include <io.h>			// for _findfirst()
+#include <sys/stat.h>
 #else
+#include <sys/stat.h>
+#include <dirent.h>
 #include <limits.h>		// for PATH_MAX
 #include <unistd.h>		// for getcwd()
+#include <time.h>		// for clock_gettime()
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>	// for setpriority()
+#include <sys/mman.h>	// for mlockall()
+#ifdef __linux__
+#include <sys/syscall.h>	// for SYS_gettid
 #endif
+#endif
+
+#include <stdtype.h>
+#include <utils/OSMutex.h>
 
 #include "utils.hpp"
 
 
+// file names of a search path directory, so that looking for a file doesn't need to try opening it
+struct DirIndex
+{
+	bool valid;		// false = directory doesn't exist or couldn't be read
+	time_t mtime;	// modification time of the directory when it was listed
+	long mtimeNs;	// nanoseconds of mtime (0 where the OS doesn't provide them)
+	bool racy;		// listed right after a change, a file may have been added without changing mtime
+	double checkTime;	// GetMonotonicTime() of the last check of mtime
+	std::set<std::string> files;
+};
+
+#define DIRIDX_CHECK_INTERVAL	2.0	// seconds, until then the index is used without checking the directory
+#define DIRIDX_RACY_TIME		2	// seconds, file systems like FAT store times with 2 second resolution
+
+#if defined(__APPLE__)
+#define STAT_MTIME_NS(st)	((long)(st).st_mtimespec.tv_nsec)
+#elif defined(st_mtime)	// glibc, musl and the BSDs define st_mtime as st_mtim.tv_sec
+#define STAT_MTIME_NS(st)	((long)(st).st_mtim.tv_nsec)
+#else
+#define STAT_MTIME_NS(st)	0L
+#endif
+
 static const char* GetLastDirSeparator(const char* filePath);
+static std::string DirIndex_FileKey(const char* fileName);
+static void DirIndex_Refresh(const std::string& dirPath, DirIndex& dirIdx);
+static bool DirIndex_FileExists(const std::string& filePath);
 //const char* GetFileTitle(const char* filePath);
 //const char* GetFileExtension(const char* filePath);
 //void StandardizeDirSeparators(std::string& filePath);
 //bool IsAbsolutePath(const char* filePath);
 //std::string CombinePaths(const std::string& basePath, const std::string& addPath);
 //std::string GetAbsolutePath(const std::string& relPath);
+#ifdef _WIN32
+static bool UTF8ToWide(const char* str, std::vector<wchar_t>& strW);
+#endif
+//FILE* fopen_utf8(const std::string& fileName, const char* mode);
+//bool GetFileStampU8(const std::string& fileNameU8, UINT64& mtime, UINT64& fileSize);
 //std::string FindFile_List(const std::vector<std::string>& fileList, const std::vector<std::string>& pathList);
 //std::string FindFile_Single(const std::string& fileName, const std::vector<std::string>& pathList);
 //std::string Vector2String(const std::vector<char>& data, size_t startPos, size_t endPos);
@@ -147,12 +196,62 @@ std::string GetAbsolutePath(const std::string& relPath)
 #endif
 }
 
+#ifdef _WIN32
+static bool UTF8ToWide(const char* str, std::vector<wchar_t>& strW)
+{
+	int bufSize;
+	
+	bufSize = MultiByteToWideChar(CP_UTF8, 0, str, -1, NULL, 0);
+	if (bufSize <= 0)
+		return false;
+	strW.resize(bufSize);
+	MultiByteToWideChar(CP_UTF8, 0, str, -1, &strW[0], bufSize);
+	return true;
+}
+#endif
+
+FILE* fopen_utf8(const std::string& fileName, const char* mode)
+{
+#ifdef _WIN32
+	std::vector<wchar_t> fileNameW;
+	std::vector<wchar_t> modeW;
+	
+	if (! UTF8ToWide(fileName.c_str(), fileNameW) || ! UTF8ToWide(mode, modeW))
+		return NULL;
+	return _wfopen(&fileNameW[0], &modeW[0]);
+#else
+	return fopen(fileName.c_str(), mode);
+#endif
+}
+
+bool GetFileStampU8(const std::string& fileNameU8, UINT64& mtime, UINT64& fileSize)
+{
+#ifdef _WIN32
+	std::vector<wchar_t> fileNameW;
+	WIN32_FILE_ATTRIBUTE_DATA fileAttr;
+	
+	if (! UTF8ToWide(fileNameU8.c_str(), fileNameW))
+		return false;
+	if (! GetFileAttributesExW(&fileNameW[0], GetFileExInfoStandard, &fileAttr))
+		return false;
+	mtime = ((UINT64)fileAttr.ftLastWriteTime.dwHighDateTime << 32) | fileAttr.ftLastWriteTime.dwLowDateTime;
+	fileSize = ((UINT64)fileAttr.nFileSizeHigh << 32) | fileAttr.nFileSizeLow;
+#else
+	struct stat fileStat;
+	
+	if (stat(fileNameU8.c_str(), &fileStat))
+		return false;
+	mtime = (UINT64)fileStat.st_mtime * 1000000000 + STAT_MTIME_NS(fileStat);
+	fileSize = (UINT64)fileStat.st_size;
+#endif
+	return true;
+}
+
 std::string FindFile_List(const std::vector<std::string>& fileList, const std::vector<std::string>& pathList)
 {
 	std::vector<std::string>::const_reverse_iterator pathIt;
 	std::vector<std::string>::const_reverse_iterator fileIt;
 	std::string fullName;
-	FILE* hFile;
 	
 	for (pathIt = pathList.rbegin(); pathIt != pathList.rend(); ++pathIt)
 	{
@@ -161,10 +260,8 @@ std::string FindFile_List(const std::vector<std::string>& fileList, const std::v
 			fullName = CombinePaths(*pathIt, *fileIt);
 			//printf("Testing path: %s ...\n", fullName.c_str());
 			
-			hFile = fopen(fullName.c_str(), "r");
-			if (hFile != NULL)
+			if (DirIndex_FileExists(fullName))
 			{
-				fclose(hFile);
 				//printf("Success.\n");
 				return fullName;
 			}
@@ -182,6 +279,126 @@ std::string FindFile_Single(const std::string& fileName, const std::vector<std::
 	return FindFile_List(fileList, pathList);
 }
 
+// Each directory is listed once and its index is reused until the directory's modification time changes.
+// This saves a round trip per probed file on network drives.
+static std::map<std::string, DirIndex> dirIndexes;
+static OS_MUTEX* dirIdxMutex = NULL;	// created on first use, that is during startup before other threads exist
+
+static std::string DirIndex_FileKey(const char* fileName)
+{
+	std::string key(fileName);
+#ifdef _WIN32
+	// case-insensitive file system
+	for (size_t curChr = 0; curChr < key.length(); curChr ++)
+	{
+		if (key[curChr] >= 'A' && key[curChr] <= 'Z')
+			key[curChr] += 'a' - 'A';
+	}
+#endif
+	return key;
+}
+
+static void DirIndex_Refresh(const std::string& dirPath, DirIndex& dirIdx)
+{
+	const char* listPath = dirPath.empty() ? "." : dirPath.c_str();
+	struct stat dirStat;
+	
+	if (stat(listPath, &dirStat))
+	{
+		dirIdx.valid = false;
+		dirIdx.files.clear();
+		return;
+	}
+	if (dirIdx.valid && ! dirIdx.racy && dirIdx.mtime == dirStat.st_mtime && dirIdx.mtimeNs == STAT_MTIME_NS(dirStat))
+		return;	// unchanged
+	
+	dirIdx.valid = true;
+	dirIdx.mtime = dirStat.st_mtime;
+	dirIdx.mtimeNs = STAT_MTIME_NS(dirStat);
+	// A file that is created later within the time stamp resolution doesn't change mtime.
+	// Such listings are confirmed by opening the file and are redone by the next check.
+	dirIdx.racy = (dirStat.st_mtime + DIRIDX_RACY_TIME >= time(NULL));
+	dirIdx.files.clear();
+#ifdef _WIN32
+	struct _finddata_t findData;
+	intptr_t hFind;
+	
+	hFind = _findfirst(CombinePaths(listPath, "*").c_str(), &findData);
+	if (hFind == -1)
+		return;
+	do
+	{
+		if (! (findData.attrib & _A_SUBDIR))
+			dirIdx.files.insert(DirIndex_FileKey(findData.name));
+	} while(! _findnext(hFind, &findData));
+	_findclose(hFind);
+#else
+	DIR* hDir;
+	struct dirent* dirEntry;
+	
+	hDir = opendir(listPath);
+	if (hDir == NULL)
+	{
+		dirIdx.valid = false;
+		return;
+	}
+	while((dirEntry = readdir(hDir)) != NULL)
+	{
+#ifdef _DIRENT_HAVE_D_TYPE
+		if (dirEntry->d_type == DT_DIR)
+			continue;
+#endif
+		dirIdx.files.insert(DirIndex_FileKey(dirEntry->d_name));
+	}
+	closedir(hDir);
+#endif
+	return;
+}
+
+static bool DirIndex_FileExists(const std::string& filePath)
+{
+	const char* sepPos1 = strrchr(filePath.c_str(), '/');
+	const char* sepPos2 = strrchr(filePath.c_str(), '\\');
+	const char* sepPos = (sepPos2 == NULL || (sepPos1 != NULL && sepPos1 > sepPos2)) ? sepPos1 : sepPos2;
+	const char* fileName = (sepPos != NULL) ? (sepPos + 1) : filePath.c_str();
+	std::string dirPath = filePath.substr(0, fileName - filePath.c_str());	// includes the separator
+	double curTime = GetMonotonicTime();
+	bool found;
+	bool probe;
+	
+	if (dirIdxMutex == NULL)
+		OSMutex_Init(&dirIdxMutex, 0);
+	OSMutex_Lock(dirIdxMutex);
+	std::map<std::string, DirIndex>::iterator dirIt = dirIndexes.find(dirPath);
+	if (dirIt == dirIndexes.end())
+	{
+		DirIndex& dirIdx = dirIndexes[dirPath];
+		dirIdx.valid = false;
+		dirIdx.racy = false;
+		dirIdx.checkTime = curTime;
+		DirIndex_Refresh(dirPath, dirIdx);
+		dirIt = dirIndexes.find(dirPath);
+	}
+	else if (curTime - dirIt->second.checkTime >= DIRIDX_CHECK_INTERVAL)
+	{
+		dirIt->second.checkTime = curTime;
+		DirIndex_Refresh(dirPath, dirIt->second);
+	}
+	found = (dirIt->second.files.find(DirIndex_FileKey(fileName)) != dirIt->second.files.end());
+	probe = (found || dirIt->second.racy);
+	OSMutex_Unlock(dirIdxMutex);
+	
+	if (probe)
+	{
+		// make sure that the file can be read (and check files that the index may have missed)
+		FILE* hFile = fopen_utf8(filePath, "rb");
+		found = (hFile != NULL);
+		if (hFile != NULL)
+			fclose(hFile);
+	}
+	return found;
+}
+
 std::string Vector2String(const std::vector<char>& data, size_t startPos, size_t endPos)
 {
 	if (endPos == std::string::npos)
@@ -291,6 +508,131 @@ int count_digits(int value)
 	return digits;
 }
 
+unsigned int GetCPUCoreCount(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+	return (sysInfo.dwNumberOfProcessors > 0) ? (unsigned int)sysInfo.dwNumberOfProcessors : 1;
+#else
+	long cpuCnt = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cpuCnt > 0) ? (unsigned int)cpuCnt : 1;
+#endif
+}
+
+double GetMonotonicTime(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq = {0};
+	LARGE_INTEGER count;
+	if (! freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif
+}
+
+int SetThreadScheduling(int policy, int priority)
+{
+#ifdef _WIN32
+	int winPrio;
+	if (policy == THRSCHED_FIFO || policy == THRSCHED_RR)
+		winPrio = THREAD_PRIORITY_TIME_CRITICAL;
+	else if (policy == THRSCHED_NICE)
+		winPrio = (priority < 0) ? THREAD_PRIORITY_HIGHEST : THREAD_PRIORITY_NORMAL;
+	else
+		winPrio = THREAD_PRIORITY_NORMAL;
+	return SetThreadPriority(GetCurrentThread(), winPrio) ? 0 : EPERM;
+#else
+	if (policy == THRSCHED_FIFO || policy == THRSCHED_RR)
+	{
+		int sPolicy = (policy == THRSCHED_FIFO) ? SCHED_FIFO : SCHED_RR;
+		struct sched_param sParam;
+		int minPrio = sched_get_priority_min(sPolicy);
+		int maxPrio = sched_get_priority_max(sPolicy);
+		
+		memset(&sParam, 0x00, sizeof(struct sched_param));
+		sParam.sched_priority = (priority < minPrio) ? minPrio : (priority > maxPrio) ? maxPrio : priority;
+		return pthread_setschedparam(pthread_self(), sPolicy, &sParam);
+	}
+	else if (policy == THRSCHED_NICE)
+	{
+#ifdef __linux__
+		// On Linux, the nice value is a property of the thread.
+		id_t tid = (id_t)syscall(SYS_gettid);
+#else
+		id_t tid = 0;	// whole process
+#endif
+		if (setpriority(PRIO_PROCESS, tid, priority))
+			return (errno == EACCES) ? EPERM : errno;
+		return 0;
+	}
+	return 0;
+#endif
+}
+
+int SetThreadCPUs(const std::vector<unsigned int>& cpuList)
+{
+	size_t curCPU;
+	
+	if (cpuList.empty())
+		return 0;
+#if defined(_WIN32)
+	DWORD_PTR cpuMask = 0;
+	for (curCPU = 0; curCPU < cpuList.size(); curCPU ++)
+	{
+		if (cpuList[curCPU] < sizeof(DWORD_PTR) * 8)
+			cpuMask |= (DWORD_PTR)1 << cpuList[curCPU];
+	}
+	return SetThreadAffinityMask(GetCurrentThread(), cpuMask) ? 0 : EINVAL;
+#elif defined(__linux__)
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	for (curCPU = 0; curCPU < cpuList.size(); curCPU ++)
+	{
+		if (cpuList[curCPU] < CPU_SETSIZE)
+			CPU_SET(cpuList[curCPU], &cpuSet);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+#else
+	return ENOSYS;
+#endif
+}
+
+int LockProcessMemory(void)
+{
+#ifdef _WIN32
+	return ENOSYS;
+#else
+	// MCL_FUTURE isn't used, because memory allocations would fail once the lock limit is reached.
+	int retVal;
+#ifdef MCL_ONFAULT
+	// Pages that aren't in RAM yet are locked when they are used first, instead of reading them in now.
+	retVal = mlockall(MCL_CURRENT | MCL_ONFAULT);
+	if (retVal && errno == EINVAL)
+		retVal = mlockall(MCL_CURRENT);	// Linux before 4.4
+#else
+	retVal = mlockall(MCL_CURRENT);
+#endif
+	if (retVal)
+		return (errno == ENOMEM) ? EPERM : errno;	// ENOMEM: RLIMIT_MEMLOCK is too low
+	return 0;
+#endif
+}
+
+void UnlockMemory(const void* ptr, size_t size)
+{
+#ifndef _WIN32
+	if (ptr != NULL && size > 0)
+		munlock(ptr, size);
+#endif
+	return;
+}
+
 void RemoveControlChars(std::string& str)
 {
 	size_t strLen = str.length();
@@ -1,8 +1,10 @@
 #ifndef __UTILS_HPP__
 #define __UTILS_HPP__
 
+#include <stdio.h>
 #include <vector>
 #include <string>
+#include <stdtype.h>
 
 #ifdef _WIN32
 // undefine some Windows API macros
@@ -16,6 +18,9 @@ void StandardizeDirSeparators(std::string& filePath);
 bool IsAbsolutePath(const char* filePath);
 std::string CombinePaths(const std::string& basePath, const std::string& addPath);
 std::string GetAbsolutePath(const std::string& relPath);
+FILE* fopen_utf8(const std::string& fileName, const char* mode);	// file name in UTF-8, also on Windows
+// modification time (in OS-specific units) and size of a file
+bool GetFileStampU8(const std::string& fileNameU8, UINT64& mtime, UINT64& fileSize);
 std::string FindFile_List(const std::vector<std::string>& fileList, const std::vector<std::string>& pathList);
 std::string FindFile_Single(const std::string& fileName, const std::vector<std::string>& pathList);
 std::string Vector2String(const std::vector<char>& data, size_t startPos = 0, size_t endPos = std::string::npos);
@@ -24,6 +29,18 @@ std::string Vector2String(const unsigned char* data, size_t startPos, size_t end
 size_t utf8strlen(const char* str);
 char* utf8strseek(const char* str, size_t numChars);
 int count_digits(int value);
+unsigned int GetCPUCoreCount(void);
+double GetMonotonicTime(void);	// in seconds, for measuring time differences
+// scheduling of the calling thread, the functions return 0 on success or an errno value
+// (EPERM = missing permissions, ENOSYS = not supported on this system)
+#define THRSCHED_NORMAL	0x00
+#define THRSCHED_NICE	0x01	// normal scheduling with a different nice value
+#define THRSCHED_FIFO	0x02	// real-time, SCHED_FIFO
+#define THRSCHED_RR		0x03	// real-time, SCHED_RR
+int SetThreadScheduling(int policy, int priority);
+int SetThreadCPUs(const std::vector<unsigned int>& cpuList);
+int LockProcessMemory(void);	// keep all current pages of the process in RAM
+void UnlockMemory(const void* ptr, size_t size);	// exclude a buffer from the memory lock
 void RemoveControlChars(std::string& str);
 void RemoveQuotationMarks(std::string& str, char quotMark);
 void u8printf(const char* format, ...);
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <stdtype.h>
+
+#include "utils.hpp"
+#include "wavwriter.hpp"
+
+
+static inline void WriteLE16(UINT8* buffer, UINT16 value);
+static inline void WriteLE32(UINT8* buffer, UINT32 value);
+
+WavWriter::WavWriter() :
+	_hFile(NULL),
+	_smplRate(0),
+	_channels(0),
+	_smplBits(0),
+	_isFloat(false),
+	_isStream(false),
+	_rawPCM(false),
+	_dataSize(0),
+	_writeError(false)
+{
+}
+
+WavWriter::~WavWriter()
+{
+	Close();
+}
+
+UINT8 WavWriter::Open(const std::string& fileName, UINT32 smplRate, UINT16 channels, UINT16 smplBits, bool isFloat)
+{
+	if (_hFile != NULL)
+		Close();
+	
+	_hFile = fopen_utf8(fileName, "wb");
+	if (_hFile == NULL)
+		return 0xFF;
+	_smplRate = smplRate;
+	_channels = channels;
+	_smplBits = smplBits;
+	_isFloat = isFloat;
+	_isStream = false;
+	_rawPCM = false;
+	_dataSize = 0;
+	_writeError = false;
+	WriteHeader();	// placeholder, the sizes are filled in by Close()
+	
+	return _writeError ? 0x01 : 0x00;
+}
+
+UINT8 WavWriter::OpenStream(FILE* hFile, UINT32 smplRate, UINT16 channels, UINT16 smplBits, bool isFloat, bool rawPCM)
+{
+	if (_hFile != NULL)
+		Close();
+	
+	_hFile = hFile;
+	_smplRate = smplRate;
+	_channels = channels;
+	_smplBits = smplBits;
+	_isFloat = isFloat;
+	_isStream = true;
+	_rawPCM = rawPCM;
+	_dataSize = 0;
+	_writeError = false;
+	if (! _rawPCM)
+		WriteHeader();
+	
+	return _writeError ? 0x01 : 0x00;
+}
+
+UINT8 WavWriter::Write(const void* data, UINT32 size)
+{
+	if (_hFile == NULL)
+		return 0xFF;
+	if (! size)
+		return 0x00;
+	
+	size_t wrtBytes = fwrite(data, 1, size, _hFile);
+	_dataSize += (UINT32)wrtBytes;
+	if (wrtBytes < size)
+	{
+		_writeError = true;
+		return 0x01;
+	}
+	return 0x00;
+}
+
+UINT8 WavWriter::Close(void)
+{
+	if (_hFile == NULL)
+		return 0x00;
+	
+	if (_isStream)
+	{
+		if (fflush(_hFile))
+			_writeError = true;
+		_hFile = NULL;
+		return _writeError ? 0x01 : 0x00;
+	}
+	fseek(_hFile, 0, SEEK_SET);
+	WriteHeader();
+	if (fclose(_hFile))
+		_writeError = true;
+	_hFile = NULL;
+	
+	return _writeError ? 0x01 : 0x00;
+}
+
+void WavWriter::WriteHeader(void)
+{
+	UINT8 hdr[0x3A];
+	UINT16 blockAlign = _channels * _smplBits / 8;
+	UINT32 dataSize = _isStream ? 0xFFFFFFFF : _dataSize;	// streams: "unknown", readers go until the end of the file
+	UINT32 hdrSize;
+	
+	memcpy(&hdr[0x00], "RIFF", 4);
+	memcpy(&hdr[0x08], "WAVE", 4);
+	memcpy(&hdr[0x0C], "fmt ", 4);
+	WriteLE16(&hdr[0x16], _channels);
+	WriteLE32(&hdr[0x18], _smplRate);
+	WriteLE32(&hdr[0x1C], _smplRate * blockAlign);	// bytes per second
+	WriteLE16(&hdr[0x20], blockAlign);
+	WriteLE16(&hdr[0x22], _smplBits);
+	if (! _isFloat)
+	{
+		WriteLE32(&hdr[0x10], 0x10);	// size of "fmt " chunk
+		WriteLE16(&hdr[0x14], 1);	// format tag: PCM
+		hdrSize = 0x24;
+	}
+	else
+	{
+		// non-PCM formats need the extension size and a "fact" chunk
+		WriteLE32(&hdr[0x10], 0x12);	// size of "fmt " chunk
+		WriteLE16(&hdr[0x14], 3);	// format tag: IEEE float
+		WriteLE16(&hdr[0x24], 0);	// cbSize
+		memcpy(&hdr[0x26], "fact", 4);
+		WriteLE32(&hdr[0x2A], 0x04);
+		WriteLE32(&hdr[0x2E], (blockAlign && ! _isStream) ? (dataSize / blockAlign) : dataSize);	// number of samples
+		hdrSize = 0x32;
+	}
+	memcpy(&hdr[hdrSize + 0x00], "data", 4);
+	WriteLE32(&hdr[hdrSize + 0x04], dataSize);
+	hdrSize += 0x08;
+	WriteLE32(&hdr[0x04], _isStream ? 0xFFFFFFFF : (hdrSize - 0x08 + _dataSize));
+	
+	if (fwrite(hdr, 1, hdrSize, _hFile) < hdrSize)
+		_writeError = true;
+	return;
+}
+
+static inline void WriteLE16(UINT8* buffer, UINT16 value)
+{
+	buffer[0x00] = (UINT8)((value >> 0) & 0xFF);
+	buffer[0x01] = (UINT8)((value >> 8) & 0xFF);
+	return;
+}
+
+static inline void WriteLE32(UINT8* buffer, UINT32 value)
+{
+	buffer[0x00] = (UINT8)((value >>  0) & 0xFF);
+	buffer[0x01] = (UINT8)((value >>  8) & 0xFF);
+	buffer[0x02] = (UINT8)((value >> 16) & 0xFF);
+	buffer[0x03] = (UINT8)((value >> 24) & 0xFF);
+	return;
+}
@@ -0,0 +1,38 @@
+#ifndef __WAVWRITER_HPP__
+#define __WAVWRITER_HPP__
+
+#include <stdio.h>
+#include <string>
+#include <stdtype.h>
+
+// minimal RIFF WAVE file writer for rendering without the audio system
+class WavWriter
+{
+public:
+	WavWriter();
+	~WavWriter();
+	
+	// isFloat: samples are IEEE floats (smplBits must be 32), else signed integers
+	UINT8 Open(const std::string& fileName, UINT32 smplRate, UINT16 channels, UINT16 smplBits, bool isFloat = false);
+	// write to an open file that can't seek (e.g. stdout), the file isn't closed by Close()
+	// The header has "unknown" sizes, rawPCM omits it.
+	UINT8 OpenStream(FILE* hFile, UINT32 smplRate, UINT16 channels, UINT16 smplBits, bool isFloat, bool rawPCM);
+	UINT8 Write(const void* data, UINT32 size);
+	UINT8 Close(void);	// finalizes the header
+	bool IsOpen(void) const	{ return _hFile != NULL; }
+	
+private:
+	void WriteHeader(void);
+	
+	FILE* _hFile;
+	UINT32 _smplRate;
+	UINT16 _channels;
+	UINT16 _smplBits;
+	bool _isFloat;
+	bool _isStream;
+	bool _rawPCM;
+	UINT32 _dataSize;
+	bool _writeError;
+};
+
+#endif	// __WAVWRITER_HPP__
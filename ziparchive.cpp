@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <zlib.h>
+
+#include <stdtype.h>
+#include <utils/OSMutex.h>
+
+#include "utils.hpp"
+#include "ziparchive.hpp"
+
+
+struct ZipEntry
+{
+	std::string name;
+	UINT16 flags;
+	UINT16 method;
+	UINT32 crc;
+	UINT32 compSize;
+	UINT32 uncompSize;
+	UINT32 localOfs;	// offset of the local file header
+};
+
+struct ZipArchive
+{
+	UINT64 mtime;	// modification time and size of the archive file when it was parsed
+	UINT64 fileSize;
+	bool valid;	// false = not a (supported) archive
+	std::vector<ZipEntry> entries;
+	std::map<std::string, size_t> nameIdx;	// lower-case name -> entries index
+};
+
+static std::string ZipName_Key(const std::string& name);
+static ZipArchive* ZipArchive_Parse(const std::string& zipPath);
+static const ZipArchive* ZipArchive_Get(const std::string& zipPath);
+static const ZipEntry* ZipArchive_FindEntry(const ZipArchive* zArc, const std::string& memberName);
+static inline UINT16 ReadLE16(const UINT8* data);
+static inline UINT32 ReadLE32(const UINT8* data);
+
+
+#define ZIPSIG_LOCAL	0x04034B50	// "PK\x03\x04"
+#define ZIPSIG_CENTRAL	0x02014B50	// "PK\x01\x02"
+#define ZIPSIG_EOCD		0x06054B50	// "PK\x05\x06"
+#define ZIP_MEMBER_MAX	0x10000000	// 256 MB, larger files aren't read
+#define DEFLATE_MAX_RATIO	1032	// deflate can't compress better than this
+
+// Archives are parsed by the first access and kept until the program ends.
+// Invalid archives are stored as well, so that they aren't parsed again.
+// Every access checks the archive file, archives that were replaced are parsed again.
+// The mutex is created by ZipArchive_Init or, when parsing the arguments, on first use.
+static std::map<std::string, ZipArchive*> zipCache;
+static OS_MUTEX* zipCacheMtx = NULL;
+
+void ZipArchive_Init(void)
+{
+	if (zipCacheMtx == NULL)
+		OSMutex_Init(&zipCacheMtx, 0);
+	return;
+}
+
+bool ZipPath_Split(const std::string& path, std::string& zipPath, std::string& memberName)
+{
+	size_t extPos;
+	
+	for (extPos = path.find('.'); extPos != std::string::npos; extPos = path.find('.', extPos + 1))
+	{
+		size_t endPos = extPos + 4;
+		if (endPos > path.length())
+			break;
+		if (ZipName_Key(path.substr(extPos, 4)) != ".zip")
+			continue;
+		if (endPos < path.length() && path[endPos] != '/' && path[endPos] != '\\')
+			continue;	// e.g. "file.zipx"
+	
+		zipPath = path.substr(0, endPos);
+		memberName = (endPos < path.length()) ? path.substr(endPos + 1) : std::string();
+		return true;
+	}
+	return false;
+}
+
+UINT8 ZipArchive_ListMembers(const std::string& zipPath, std::vector<std::string>& names)
+{
+	const ZipArchive* zArc;
+	size_t curEnt;
+	
+	names.clear();
+	ZipArchive_Init();
+	OSMutex_Lock(zipCacheMtx);
+	zArc = ZipArchive_Get(zipPath);
+	if (zArc == NULL)
+	{
+		OSMutex_Unlock(zipCacheMtx);
+		return 0xFF;
+	}
+	for (curEnt = 0; curEnt < zArc->entries.size(); curEnt ++)
+	{
+		const ZipEntry& ze = zArc->entries[curEnt];
+		if (! ze.name.empty() && ze.name[ze.name.length() - 1] != '/')	// skip directories
+			names.push_back(ze.name);
+	}
+	OSMutex_Unlock(zipCacheMtx);
+	return 0x00;
+}
+
+bool ZipArchive_HasMember(const std::string& zipPath, const std::string& memberName)
+{
+	const ZipArchive* zArc;
+	bool found;
+	
+	ZipArchive_Init();
+	OSMutex_Lock(zipCacheMtx);
+	zArc = ZipArchive_Get(zipPath);
+	found = (zArc != NULL && ZipArchive_FindEntry(zArc, memberName) != NULL);
+	OSMutex_Unlock(zipCacheMtx);
+	return found;
+}
+
+UINT8 ZipArchive_ReadMember(const std::string& zipPath, const std::string& memberName, std::vector<UINT8>& data)
+{
+	const ZipArchive* zArc;
+	const ZipEntry* zePtr;
+	ZipEntry zeCopy;	// the cached archive may be replaced while reading
+	const ZipEntry* ze = &zeCopy;
+	UINT64 arcSize;
+	UINT64 dataOfs;
+	FILE* hFile;
+	UINT8 locHdr[0x1E];
+	std::vector<UINT8> compData;
+	
+	ZipArchive_Init();
+	OSMutex_Lock(zipCacheMtx);
+	zArc = ZipArchive_Get(zipPath);
+	zePtr = (zArc != NULL) ? ZipArchive_FindEntry(zArc, memberName) : NULL;
+	if (zePtr != NULL)
+		zeCopy = *zePtr;
+	arcSize = (zArc != NULL) ? zArc->fileSize : 0;
+	OSMutex_Unlock(zipCacheMtx);
+	if (zArc == NULL)
+		return 0xFF;	// not an archive
+	if (zePtr == NULL)
+		return 0xFE;	// file not found
+	if (ze->flags & 0x0001)
+		return 0x80;	// encrypted
+	if (ze->method != 0 && ze->method != Z_DEFLATED)
+		return 0x81;	// unsupported compression method
+	// The sizes are checked before allocating memory, as they may come from a broken archive.
+	if (ze->uncompSize > ZIP_MEMBER_MAX)
+		return 0x82;	// too large
+	if (ze->method == 0 ? (ze->uncompSize != ze->compSize) :
+		((UINT64)ze->uncompSize > (UINT64)ze->compSize * DEFLATE_MAX_RATIO))
+		return 0xC2;	// corrupted
+	
+	hFile = fopen_utf8(zipPath, "rb");
+	if (hFile == NULL)
+		return 0xFF;
+	// The local header may have a different "extra field" than the central directory.
+	if (fseek(hFile, ze->localOfs, SEEK_SET) || fread(locHdr, 1, 0x1E, hFile) < 0x1E ||
+		ReadLE32(&locHdr[0x00]) != ZIPSIG_LOCAL)
+	{
+		fclose(hFile);
+		return 0xC0;
+	}
+	dataOfs = (UINT64)ze->localOfs + 0x1E + ReadLE16(&locHdr[0x1A]) + ReadLE16(&locHdr[0x1C]);
+	if (dataOfs + ze->compSize > arcSize)
+	{
+		fclose(hFile);
+		return 0xC0;	// truncated archive
+	}
+	compData.resize(ze->compSize);
+	if (fseek(hFile, ReadLE16(&locHdr[0x1A]) + ReadLE16(&locHdr[0x1C]), SEEK_CUR) ||
+		(! compData.empty() && fread(&compData[0], 1, compData.size(), hFile) < compData.size()))
+	{
+		fclose(hFile);
+		return 0xC0;	// truncated archive
+	}
+	fclose(hFile);
+	
+	if (ze->method == 0)
+	{
+		// stored
+		data.swap(compData);
+	}
+	else
+	{
+		z_stream zStrm;
+		int retVal;
+	
+		data.resize(ze->uncompSize);
+		memset(&zStrm, 0x00, sizeof(z_stream));
+		if (inflateInit2(&zStrm, -MAX_WBITS) != Z_OK)	// raw deflate data
+			return 0xC1;
+		zStrm.next_in = compData.empty() ? NULL : &compData[0];
+		zStrm.avail_in = (uInt)compData.size();
+		zStrm.next_out = data.empty() ? NULL : &data[0];
+		zStrm.avail_out = (uInt)data.size();
+		retVal = inflate(&zStrm, Z_FINISH);
+		inflateEnd(&zStrm);
+		if (retVal != Z_STREAM_END || zStrm.avail_out > 0)
+			return 0xC1;
+	}
+	if (data.size() != ze->uncompSize ||
+		crc32(0, data.empty() ? NULL : &data[0], (uInt)data.size()) != ze->crc)
+		return 0xC2;	// corrupted
+	
+	return 0x00;
+}
+
+// ZIP file names are case-sensitive, but Windows users expect "Track.vgz" to work for "track.vgz" as well.
+static std::string ZipName_Key(const std::string& name)
+{
+	std::string key(name);
+	size_t curChr;
+	
+	for (curChr = 0; curChr < key.length(); curChr ++)
+	{
+		if (key[curChr] >= 'A' && key[curChr] <= 'Z')
+			key[curChr] += 'a' - 'A';
+		else if (key[curChr] == '\\')
+			key[curChr] = '/';
+	}
+	return key;
+}
+
+// reads the central directory (ZIP64 archives aren't supported)
+static ZipArchive* ZipArchive_Parse(const std::string& zipPath)
+{
+	FILE* hFile;
+	long fileSize;
+	std::vector<UINT8> buffer;
+	size_t tailSize;
+	size_t eocdPos;
+	UINT32 cdSize;
+	UINT32 cdOfs;
+	UINT16 entryCnt;
+	
+	hFile = fopen_utf8(zipPath, "rb");
+	if (hFile == NULL)
+		return NULL;
+	if (fseek(hFile, 0, SEEK_END) || (fileSize = ftell(hFile)) < 0x16)
+	{
+		fclose(hFile);
+		return NULL;
+	}
+	
+	// The "end of central directory" record is at the end of the file, followed by a comment of up to 64 KB.
+	tailSize = (fileSize < 0x10000 + 0x16) ? (size_t)fileSize : (0x10000 + 0x16);
+	buffer.resize(tailSize);
+	if (fseek(hFile, fileSize - (long)tailSize, SEEK_SET) || fread(&buffer[0], 1, tailSize, hFile) < tailSize)
+	{
+		fclose(hFile);
+		return NULL;
+	}
+	for (eocdPos = tailSize - 0x16; eocdPos != (size_t)-1; eocdPos --)
+	{
+		if (ReadLE32(&buffer[eocdPos]) == ZIPSIG_EOCD)
+			break;
+	}
+	if (eocdPos == (size_t)-1)
+	{
+		fclose(hFile);
+		return NULL;
+	}
+	entryCnt = ReadLE16(&buffer[eocdPos + 0x0A]);
+	cdSize = ReadLE32(&buffer[eocdPos + 0x0C]);
+	cdOfs = ReadLE32(&buffer[eocdPos + 0x10]);
+	if (entryCnt == 0xFFFF || cdOfs == 0xFFFFFFFF || (UINT64)cdOfs + cdSize > (UINT64)fileSize)
+	{
+		fclose(hFile);
+		return NULL;	// ZIP64 or broken
+	}
+	
+	buffer.resize(cdSize);
+	if (cdSize > 0 && (fseek(hFile, (long)cdOfs, SEEK_SET) || fread(&buffer[0], 1, cdSize, hFile) < cdSize))
+	{
+		fclose(hFile);
+		return NULL;
+	}
+	fclose(hFile);
+	
+	ZipArchive* zArc = new ZipArchive;
+	size_t curPos = 0;
+	zArc->valid = true;
+	for (UINT16 curEnt = 0; curEnt < entryCnt; curEnt ++)
+	{
+		if (curPos + 0x2E > buffer.size() || ReadLE32(&buffer[curPos]) != ZIPSIG_CENTRAL)
+			break;
+		const UINT8* entData = &buffer[curPos];
+		UINT16 nameLen = ReadLE16(&entData[0x1C]);
+		UINT16 extraLen = ReadLE16(&entData[0x1E]);
+		UINT16 cmtLen = ReadLE16(&entData[0x20]);
+		if (curPos + 0x2E + nameLen > buffer.size())
+			break;
+	
+		ZipEntry ze;
+		ze.flags = ReadLE16(&entData[0x08]);
+		ze.method = ReadLE16(&entData[0x0A]);
+		ze.crc = ReadLE32(&entData[0x10]);
+		ze.compSize = ReadLE32(&entData[0x14]);
+		ze.uncompSize = ReadLE32(&entData[0x18]);
+		ze.localOfs = ReadLE32(&entData[0x2A]);
+		ze.name.assign((const char*)&entData[0x2E], nameLen);	// UTF-8 or CP437, both are fine for ASCII names
+		zArc->nameIdx[ZipName_Key(ze.name)] = zArc->entries.size();
+		zArc->entries.push_back(ze);
+		curPos += 0x2E + nameLen + extraLen + cmtLen;
+	}
+	
+	return zArc;
+}
+
+// zipCacheMtx must be locked while the archive is used, a later call may replace it.
+static const ZipArchive* ZipArchive_Get(const std::string& zipPath)
+{
+	std::map<std::string, ZipArchive*>::iterator arcIt;
+	ZipArchive* zArc;
+	UINT64 mtime;
+	UINT64 fileSize;
+	
+	if (! GetFileStampU8(zipPath, mtime, fileSize))
+		return NULL;
+	arcIt = zipCache.find(zipPath);
+	if (arcIt != zipCache.end())
+	{
+		zArc = arcIt->second;
+		if (zArc->mtime == mtime && zArc->fileSize == fileSize)
+			return zArc->valid ? zArc : NULL;
+		delete zArc;	// the archive was replaced
+		zipCache.erase(arcIt);
+	}
+	
+	zArc = ZipArchive_Parse(zipPath);
+	if (zArc == NULL)
+	{
+		zArc = new ZipArchive;
+		zArc->valid = false;
+	}
+	zArc->mtime = mtime;
+	zArc->fileSize = fileSize;
+	zipCache[zipPath] = zArc;
+	return zArc->valid ? zArc : NULL;
+}
+
+static const ZipEntry* ZipArchive_FindEntry(const ZipArchive* zArc, const std::string& memberName)
+{
+	std::map<std::string, size_t>::const_iterator nameIt;
+	
+	nameIt = zArc->nameIdx.find(ZipName_Key(memberName));
+	if (nameIt == zArc->nameIdx.end())
+		return NULL;
+	return &zArc->entries[nameIt->second];
+}
+
+static inline UINT16 ReadLE16(const UINT8* data)
+{
+	return (data[0x00] << 0) | (data[0x01] << 8);
+}
+
+static inline UINT32 ReadLE32(const UINT8* data)
+{
+	return	(data[0x00] <<  0) | (data[0x01] <<  8) |
+			(data[0x02] << 16) | ((UINT32)data[0x03] << 24);
+}
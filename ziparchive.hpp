@@ -0,0 +1,22 @@
+#ifndef __ZIPARCHIVE_HPP__
+#define __ZIPARCHIVE_HPP__
+
+#include <string>
+#include <vector>
+#include <stdtype.h>
+
+// ZIP archive access for paths like "pack.zip/track.vgz"
+// The central directory of each archive is kept in memory until the archive file changes.
+
+// creates the lock for the archive cache, must be called before using archives from multiple threads
+void ZipArchive_Init(void);
+// Split a path at its first ".zip" component. memberName is empty when the path names the archive itself.
+// Returns false for paths without a ".zip" component. (The archive isn't checked.)
+bool ZipPath_Split(const std::string& path, std::string& zipPath, std::string& memberName);
+// names of all files in the archive
+UINT8 ZipArchive_ListMembers(const std::string& zipPath, std::vector<std::string>& names);
+bool ZipArchive_HasMember(const std::string& zipPath, const std::string& memberName);
+// decompress a single file of the archive
+UINT8 ZipArchive_ReadMember(const std::string& zipPath, const std::string& memberName, std::vector<UINT8>& data);
+
+#endif	// __ZIPARCHIVE_HPP__